@@ -0,0 +1,46 @@
+#ifndef __ELEVATOR_OPS_H
+#define __ELEVATOR_OPS_H
+
+#include <linux/types.h>
+
+#define ELEVATOR_ETA_UNKNOWN 0xffffffffU
+
+// argument of issue_request_ext and query_request. fields are only ever added
+// at the end, a caller built against a larger struct must leave the extra
+// bytes zero
+struct elevator_request {
+	__s32 start_floor;
+	__s32 dest_floor;
+	__s32 type;
+	__u32 count;		// identical pets in the request, 0 is taken as 1
+	__u32 id;		// filled in by issue_request_ext, the key for query_request
+	__u32 pickup_ms;	// estimates from the time of the call, ELEVATOR_ETA_UNKNOWN
+	__u32 delivery_ms;	// while the elevator isn't running
+	__u32 system;		// elevator system, 0 is the one the original calls drive
+};
+
+// ops table a module registers to back the elevator system calls. no module
+// reference is taken, unregistering waits out calls in flight instead
+struct elevator_ops {
+	int (*start_elevator)(void);
+	int (*issue_request)(int, int, int);
+	int (*issue_request_ext)(struct elevator_request *);	// optional
+	int (*query_request)(struct elevator_request *);	// optional
+	int (*stop_elevator)(void);
+	int (*start_system)(unsigned int);	// optional, start/stop_elevator
+	int (*stop_system)(unsigned int);	// for one system by id
+};
+
+// returns -EBUSY if another module already owns the system calls
+int elevator_register_ops(const struct elevator_ops *ops);
+
+// once this returns no call into ops is still running, so the module can unload
+void elevator_unregister_ops(const struct elevator_ops *ops);
+
+// warm restart: an unloading module hands its queued pets to the next one.
+// stash takes ownership of a kvmalloc'd buffer (replacing any older one),
+// take hands it back (or NULL) and the caller must kvfree it
+void elevator_stash_checkpoint(void *buf, size_t len);
+void *elevator_take_checkpoint(size_t *len);
+
+#endif
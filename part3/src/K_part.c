@@ -0,0 +1,454 @@
+// Reference engine: the earlier, simpler take on the elevator. One kthread
+// does everything, a pet at a time (1s each to unload or load) and loading
+// stops at the first pet that doesn't fit. It registers the same system calls
+// as elevator.c (only one of the two can be loaded) and reports the same A/B
+// numbers in /proc/elevator_stats, see tests/elevator-test/ab.c.
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/list.h>
+#include <linux/kthread.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/ktime.h>
+#include <linux/sched.h>   // For cond_resched()
+#include <linux/delay.h>   // For ssleep()
+#include "../elevator_ops.h"
+#include "wait_hist.h"
+
+#define PROC_FILENAME "elevator"
+#define STATS_FILENAME "elevator_stats"
+
+// same model times as elevator.c, so both engines can be sped up alike
+static unsigned int floor_ms = 2000;
+module_param(floor_ms, uint, 0644);
+MODULE_PARM_DESC(floor_ms, "Time to move one floor in ms (default 2000)");
+static unsigned int transfer_ms = 1000;
+module_param(transfer_ms, uint, 0644);
+MODULE_PARM_DESC(transfer_ms, "Time to load/unload one pet in ms (default 1000)");
+
+typedef enum { OFFLINE, IDLE, LOADING, UP, DOWN } state_t;
+enum { DIR_DOWN = -1, DIR_UP = 1 };
+
+static const int pet_weights[] = { 3, 14, 10, 16 };
+static const char pet_chars[] = { 'C', 'P', 'H', 'D' };
+
+typedef struct {
+    int type;
+    int weight;
+    int dest_floor;
+    ktime_t arrival;
+    struct list_head list;
+} Pet;
+
+static DEFINE_MUTEX(elevator_mutex);
+static LIST_HEAD(elevator_pets);
+static struct list_head floor_queues[6];   // 1..5
+static int floor_waiting[6];
+static int current_floor = 1;
+static int direction = DIR_UP;
+static int current_weight;
+static int num_pets_in_elevator;
+static state_t state = OFFLINE;
+static int stop_requested;
+static struct task_struct *elevator_task;
+
+// all under elevator_mutex
+static u64 requests_issued, pets_loaded, pets_serviced, floors_traveled, load_moved;
+static u64 wait_ns, wait_max_ns;
+static struct wait_hist wait_hist;
+
+static bool has_requests_above(int floor) {
+    Pet *pet;
+    int f;
+  
+    list_for_each_entry(pet, &elevator_pets, list) {
+        if (pet->dest_floor > floor)
+            return true;
+    }
+    
+    for (f = floor + 1; f <= 5; f++) {
+        if (!list_empty(&floor_queues[f]))
+            return true;
+    }
+    
+    return false;
+}
+
+static bool has_requests_below(int floor) {
+    Pet *pet;
+    int f;
+    
+
+    list_for_each_entry(pet, &elevator_pets, list) {
+        if (pet->dest_floor < floor)
+            return true;
+    }
+    
+ 
+    for (f = 1; f < floor; f++) {
+        if (!list_empty(&floor_queues[f]))
+            return true;
+    }
+    
+    return false;
+}
+static bool any_waiting_pets(void) {
+    int f;
+    for (f = 1; f <= 5; f++) {
+        if (!list_empty(&floor_queues[f]))
+            return true;
+    }
+    return false;
+}
+
+static void unload_pets(void) {
+    Pet *pet, *tmp;
+    
+    list_for_each_entry_safe(pet, tmp, &elevator_pets, list) {
+        if (pet->dest_floor == current_floor) {
+            state = LOADING;
+            list_del(&pet->list);
+            current_weight -= pet->weight;
+            num_pets_in_elevator--;
+            pets_serviced++;
+            
+            // Unlock mutex before sleeping
+            mutex_unlock(&elevator_mutex);
+            msleep(transfer_ms); // 1 second to unload
+            
+            // Re-acquire lock, the caller expects it held
+            mutex_lock(&elevator_mutex);
+            
+            kfree(pet);
+        }
+    }
+}
+
+// Load pets at current floor (FIFO with weight/capacity constraints)
+static void load_pets(void) {
+    Pet *pet, *tmp;
+    
+    list_for_each_entry_safe(pet, tmp, &floor_queues[current_floor], list) {
+        // Check capacity constraints
+        if (num_pets_in_elevator >= 5)
+            break;
+        if (current_weight + pet->weight > 50)
+            break;
+        
+        // Load pet (FIFO order maintained by list)
+        state = LOADING;
+        list_del(&pet->list);
+        list_add_tail(&pet->list, &elevator_pets);
+        current_weight += pet->weight;
+        num_pets_in_elevator++;
+        floor_waiting[current_floor]--;
+
+        u64 wait = ktime_to_ns(ktime_sub(ktime_get(), pet->arrival));
+        pets_loaded++;
+        wait_ns += wait;
+        wait_max_ns = max(wait_max_ns, wait);
+        wait_hist.count[wait_hist_bucket(div_u64(wait, NSEC_PER_MSEC))]++;
+        
+        // Unlock mutex before sleeping
+        mutex_unlock(&elevator_mutex);
+        msleep(transfer_ms); // 1 second to load
+        
+        // Re-acquire lock, the caller expects it held
+        mutex_lock(&elevator_mutex);
+    }
+}
+
+// Main elevator scheduling thread (LOOK Algorithm)
+static int elevator_thread(void *data) {
+    while (!kthread_should_stop()) {
+        
+        // give up the cpu if something else wants it, the sleeps below
+        // are what keep this loop from spinning
+        cond_resched();
+        
+        // Lock shared data with interruptible lock
+        if (mutex_lock_interruptible(&elevator_mutex)) {
+            // Interrupted by signal, continue
+            continue;
+        }
+        
+        // Step 1: Unload pets at current floor
+        unload_pets();
+        
+        // Step 2: Load pets at current floor
+        load_pets();
+        
+        // Step 3: Check if should stop
+        if (stop_requested && num_pets_in_elevator == 0 && !any_waiting_pets()) {
+            state = OFFLINE;
+            mutex_unlock(&elevator_mutex);
+            break;
+        }
+        
+        // Step 4: Check if idle (no pets in elevator, no pets waiting)
+        if (num_pets_in_elevator == 0 && !any_waiting_pets()) {
+            state = IDLE;
+            mutex_unlock(&elevator_mutex);
+            
+            // Block thread when not doing anything useful
+            msleep(transfer_ms); // Sleep for 1 second when idle
+            continue;
+        }
+        
+        // Step 5: LOOK Algorithm - Move in current direction
+        if (direction == DIR_UP) {
+            if (has_requests_above(current_floor)) {
+                // Continue moving up
+                state = UP;
+                
+                // Unlock before sleeping (don't hold lock during delay)
+                mutex_unlock(&elevator_mutex);
+                msleep(floor_ms); // 2 seconds to move between floors
+            
+                if (mutex_lock_interruptible(&elevator_mutex))
+                    continue;
+                
+                current_floor++;
+                floors_traveled++;
+                load_moved += current_weight;
+                mutex_unlock(&elevator_mutex);
+                
+            } else if (has_requests_below(current_floor)) {
+                // Reverse direction to down
+                direction = DIR_DOWN;
+                mutex_unlock(&elevator_mutex);
+                
+            } else {
+                // No requests anywhere - go idle
+                state = IDLE;
+                mutex_unlock(&elevator_mutex);
+            }
+            
+        } else { // direction == DIR_DOWN
+            if (has_requests_below(current_floor)) {
+                // Continue moving down
+                state = DOWN;
+                
+                // Unlock before sleeping
+                mutex_unlock(&elevator_mutex);
+                msleep(floor_ms); // 2 seconds to move between floors
+                
+                // Re-acquire lock to update floor
+                if (mutex_lock_interruptible(&elevator_mutex))
+                    continue;
+                
+                current_floor--;
+                floors_traveled++;
+                load_moved += current_weight;
+                mutex_unlock(&elevator_mutex);
+                
+            } else if (has_requests_above(current_floor)) {
+                // Reverse direction to up
+                direction = DIR_UP;
+                mutex_unlock(&elevator_mutex);
+                
+            } else {
+                // No requests anywhere - go idle
+                state = IDLE;
+                mutex_unlock(&elevator_mutex);
+            }
+        }
+    }
+    
+    return 0;
+}
+
+
+static int kpart_start(void) {
+    struct task_struct *old, *task;
+
+    mutex_lock(&elevator_mutex);
+    if (state != OFFLINE) {
+        mutex_unlock(&elevator_mutex);
+        return 1;
+    }
+    old = elevator_task;
+    elevator_task = NULL;
+    state = IDLE;
+    current_floor = 1;
+    direction = DIR_UP;
+    stop_requested = 0;
+    mutex_unlock(&elevator_mutex);
+
+    // the last run's thread exits by itself after a stop, we still hold a reference
+    if (old) {
+        kthread_stop(old);
+        put_task_struct(old);
+    }
+
+    task = kthread_create(elevator_thread, NULL, "kpart_elevator");
+    if (IS_ERR(task)) {
+        mutex_lock(&elevator_mutex);
+        state = OFFLINE;
+        mutex_unlock(&elevator_mutex);
+        return -ENOMEM;
+    }
+    get_task_struct(task);
+    mutex_lock(&elevator_mutex);
+    elevator_task = task;
+    mutex_unlock(&elevator_mutex);
+    wake_up_process(task);
+    return 0;
+}
+
+static int kpart_issue(int start_floor, int dest_floor, int type) {
+    Pet *pet;
+
+    if (start_floor < 1 || start_floor > 5 || dest_floor < 1 || dest_floor > 5 ||
+        start_floor == dest_floor || type < 0 || type > 3)
+        return 1;
+
+    pet = kmalloc(sizeof(*pet), GFP_KERNEL);
+    if (!pet)
+        return -ENOMEM;
+    pet->type = type;
+    pet->weight = pet_weights[type];
+    pet->dest_floor = dest_floor;
+    pet->arrival = ktime_get();
+
+    mutex_lock(&elevator_mutex);
+    list_add_tail(&pet->list, &floor_queues[start_floor]);
+    floor_waiting[start_floor]++;
+    requests_issued++;
+    mutex_unlock(&elevator_mutex);
+    return 0;
+}
+
+// the thread serves everything still waiting, then goes OFFLINE
+static int kpart_stop(void) {
+    int ret = 0;
+
+    mutex_lock(&elevator_mutex);
+    if (state == OFFLINE || stop_requested)
+        ret = 1;
+    else
+        stop_requested = 1;
+    mutex_unlock(&elevator_mutex);
+    return ret;
+}
+
+static const struct elevator_ops kpart_ops = {
+    .start_elevator = kpart_start,
+    .issue_request  = kpart_issue,
+    .stop_elevator  = kpart_stop,
+};
+
+// same layout as elevator.c
+static int kpart_proc_show(struct seq_file *m, void *v) {
+    static const char *state_str[] = { "OFFLINE", "IDLE", "LOADING", "UP", "DOWN" };
+    int total_waiting = 0;
+    Pet *pet;
+
+    mutex_lock(&elevator_mutex);
+    seq_printf(m, "Elevator state: %s\n", state_str[state]);
+    seq_printf(m, "Current floor: %d\n", current_floor);
+    seq_printf(m, "Current load: %d lbs\n", current_weight);
+    seq_printf(m, "Elevator status:");
+    list_for_each_entry(pet, &elevator_pets, list)
+        seq_printf(m, " %c%d", pet_chars[pet->type], pet->dest_floor);
+    seq_printf(m, "\n\n");
+
+    for (int f = 5; f >= 1; f--) {
+        seq_printf(m, "[%c] Floor %d: %d ", current_floor == f ? '*' : ' ', f, floor_waiting[f]);
+        list_for_each_entry(pet, &floor_queues[f], list)
+            seq_printf(m, "%c%d ", pet_chars[pet->type], pet->dest_floor);
+        seq_printf(m, "\n");
+        total_waiting += floor_waiting[f];
+    }
+    seq_printf(m, "\nNumber of pets waiting: %d\n", total_waiting);
+    seq_printf(m, "Number of pets serviced: %llu\n", pets_serviced);
+    mutex_unlock(&elevator_mutex);
+    return 0;
+}
+
+// the lines tests/elevator-test/ab.c compares, named as in elevator.c
+static int kpart_stats_show(struct seq_file *m, void *v) {
+    mutex_lock(&elevator_mutex);
+    seq_printf(m, "Requests issued: %llu\n", requests_issued);
+    seq_printf(m, "Pets loaded: %llu\n", pets_loaded);
+    seq_printf(m, "Pets unloaded: %llu\n", pets_serviced);
+    seq_printf(m, "Floors traveled: %llu\n", floors_traveled);
+    seq_printf(m, "Mean wait: %llu ms\n", pets_loaded ? div64_u64(wait_ns, pets_loaded) / NSEC_PER_MSEC : 0);
+    seq_printf(m, "Max wait: %llu ms\n", wait_max_ns / NSEC_PER_MSEC);
+    seq_printf(m, "P99 wait: %llu ms\n", wait_hist_percentile(&wait_hist, 99));
+    seq_printf(m, "Car utilization: %llu%%\n",
+               floors_traveled ? div64_u64(load_moved * 100, floors_traveled * 50) : 0);
+    mutex_unlock(&elevator_mutex);
+    return 0;
+}
+
+static int kpart_proc_open(struct inode *inode, struct file *file) {
+    return single_open(file, kpart_proc_show, NULL);
+}
+
+static int kpart_stats_open(struct inode *inode, struct file *file) {
+    return single_open(file, kpart_stats_show, NULL);
+}
+
+static const struct proc_ops kpart_proc_ops = {
+    .proc_open    = kpart_proc_open,
+    .proc_read    = seq_read,
+    .proc_lseek   = seq_lseek,
+    .proc_release = single_release,
+};
+
+static const struct proc_ops kpart_stats_proc_ops = {
+    .proc_open    = kpart_stats_open,
+    .proc_read    = seq_read,
+    .proc_lseek   = seq_lseek,
+    .proc_release = single_release,
+};
+
+static int __init kpart_init(void) {
+    int ret = -ENOMEM;
+
+    for (int f = 1; f <= 5; f++)
+        INIT_LIST_HEAD(&floor_queues[f]);
+
+    if (!proc_create(PROC_FILENAME, 0666, NULL, &kpart_proc_ops))
+        return -ENOMEM;
+    if (!proc_create(STATS_FILENAME, 0444, NULL, &kpart_stats_proc_ops))
+        goto err_proc;
+    ret = elevator_register_ops(&kpart_ops);
+    if (ret)
+        goto err_stats;
+    return 0;
+
+err_stats:
+    remove_proc_entry(STATS_FILENAME, NULL);
+err_proc:
+    remove_proc_entry(PROC_FILENAME, NULL);
+    return ret;
+}
+
+static void __exit kpart_exit(void) {
+    Pet *pet, *tmp;
+
+    elevator_unregister_ops(&kpart_ops);
+    if (elevator_task) {
+        kthread_stop(elevator_task);
+        put_task_struct(elevator_task);
+    }
+    remove_proc_entry(PROC_FILENAME, NULL);
+    remove_proc_entry(STATS_FILENAME, NULL);
+
+    list_for_each_entry_safe(pet, tmp, &elevator_pets, list)
+        kfree(pet);
+    for (int f = 1; f <= 5; f++) {
+        list_for_each_entry_safe(pet, tmp, &floor_queues[f], list)
+            kfree(pet);
+    }
+}
+
+module_init(kpart_init);
+module_exit(kpart_exit);
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Pet elevator, per-pet reference engine");
@@ -10,14 +10,57 @@
 #include <linux/slab.h>
 #include <linux/errno.h>
 #include <linux/sched.h> 
+#include <linux/miscdevice.h>
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/poll.h>
+#include <linux/percpu.h>
+#include <linux/ktime.h>
+#include <linux/xarray.h>
+#if IS_ENABLED(CONFIG_BPF_JIT) && IS_ENABLED(CONFIG_BPF_SYSCALL)
+#define ELEVATOR_BPF_SCHED
+#include <linux/bpf.h>
+#include <linux/btf.h>
+#include <linux/bpf_verifier.h>
+#endif
+#include "../elevator_ops.h"
+#include "elevator_sched.h"
+#include "wait_hist.h"
  
 // Constants and Pet Structures
 #define MIN_FLOOR 1
 #define MAX_FLOOR 5
 #define MAX_PETS 5
 #define MAX_WEIGHT 50
+#define MAX_GROUP 2047  // most pets one request can bring, fits pet_slot_t.count
 #define NUM_FLOORS 5
 #define PROC_FILENAME "elevator"
+#define STATS_FILENAME "elevator_stats"
+#define SUMMARY_FILENAME "elevator_summary"
+#define TRAFFIC_FILENAME "elevator_traffic"
+#define TIMING_FILENAME "elevator_timing"
+#define SYSTEMS_DIRNAME "elevators"
+#define CONTROL_FILENAME "control"
+#define MAX_SYSTEMS 64
+
+// travel and transfer times, lowered by the KUnit suite to run the model faster
+static unsigned int floor_ms = 2000;
+module_param(floor_ms, uint, 0644);
+MODULE_PARM_DESC(floor_ms, "Time to move one floor in ms (default 2000)");
+static unsigned int transfer_ms = 1000;
+module_param(transfer_ms, uint, 0644);
+MODULE_PARM_DESC(transfer_ms, "Time to load/unload at a stop in ms (default 1000)");
+// the car runs past empty floors without stopping, every floor after the first
+// of a run takes cruise_ms. 0 keeps floor_ms for all of them
+static unsigned int cruise_ms;
+module_param(cruise_ms, uint, 0644);
+MODULE_PARM_DESC(cruise_ms, "Time per floor after the first of a multi-floor run in ms, 0 for floor_ms (default 0)");
+// 0 throws away what the last module checkpointed, for runs (like ab's) that
+// have to start from an empty building
+static bool restore = true;
+module_param(restore, bool, 0444);
+MODULE_PARM_DESC(restore, "Restore the pets and systems the last module left behind (default 1)");
 
 //Pet types + weights
 //part d
@@ -25,20 +68,207 @@
 #define PU_TYPE 1 
 #define PH_TYPE 2 
 #define DA_TYPE 3 
+#define NR_PET_TYPES 4
 
 #define CH_WEIGHT 3
 #define PU_WEIGHT 14
 #define PH_WEIGHT 10
 #define DA_WEIGHT 16
 
-typedef struct pet
-{
-  int type;
-  int weight;
+// waiting pets store their arrival in ticks after their floor's base time
+#define ARRIVAL_TICK_MS 10
+#define FLOOR_RING_MIN 16  // first allocation for a floor's ring, doubles when full
+
+// request ETAs replay the scheduler for at most this many stops, and this many
+// decisions in all in case a scheduling policy wanders without stopping. with
+// more than ETA_MAX_SLOTS groups waiting nobody gets an estimate
+#define ETA_MAX_STOPS 256
+#define ETA_MAX_STEPS (ETA_MAX_STOPS * 2 * NUM_FLOORS)
+#define ETA_MAX_SLOTS 1024
+
+// traffic pattern detection over the last TRAFFIC_WINDOW requests. a peak
+// starts once TRAFFIC_ENTER_PCT of them start (up) or end (down) at the lobby
+// and is over below TRAFFIC_LEAVE_PCT, so a window hovering at the line
+// doesn't flip the mode back and forth
+#define TRAFFIC_WINDOW 64
+#define TRAFFIC_MIN_SAMPLES 16
+#define TRAFFIC_ENTER_PCT 60
+#define TRAFFIC_LEAVE_PCT 40
+#define TRAFFIC_HISTORY 16
+
+// a move or dwell finishing more than JITTER_OVERRUN_PCT late, or a thread
+// taking more than JITTER_WAKE_OVERRUN_US to pick up a handoff, is an overrun
+#define JITTER_OVERRUN_PCT 10
+#define JITTER_WAKE_OVERRUN_US 1000
+#define JITTER_BUCKETS 24  // late by 0, < 2 us, < 4 us ... the last is 4 s and up
+
+// submission/completion rings shared with userspace through /dev/elevator_ring
+// (layout must match wrappers.h)
+#define RING_DEVNAME "elevator_ring"
+#define RING_SQ_ENTRIES 256
+#define RING_CQ_ENTRIES 1024
+#define RING_NEED_WAKEUP 1      // kernel drained the sq and wants an ENTER for the next one
+#define RING_DRAIN_BATCH 32     // submissions queued per pass under elev->lock
+#define RING_EVENT_ACCEPTED 1   // result is what issue_request would have returned
+#define RING_EVENT_DELIVERED 2
+#define ELEVATOR_RING_ENTER _IO('e', 1)
+
+struct elevator_sqe {
   int start_floor;
   int dest_floor;
-  struct list_head list;  //linked lead node head
-} pet_t;
+  int type;
+  int count;  // pets in the group, 0 is taken as 1
+  __u64 tag;
+};
+
+struct elevator_cqe {
+  __u64 tag;
+  int event;
+  int result;
+};
+
+struct elevator_ring {
+  // user writes sq_tail and cq_head, the kernel writes everything else
+  __u32 sq_head;
+  __u32 sq_tail;
+  __u32 flags;
+  __u32 sq_entries;
+  __u32 cq_head __attribute__((aligned(64)));
+  __u32 cq_tail;
+  __u32 cq_overflow;
+  __u32 cq_entries;
+  struct elevator_sqe sqes[RING_SQ_ENTRIES] __attribute__((aligned(64)));
+  struct elevator_cqe cqes[RING_CQ_ENTRIES];
+};
+
+// why a request was turned away
+enum reject_reason {
+  REJECT_FLOOR,       // start or destination out of range
+  REJECT_SAME_FLOOR,
+  REJECT_TYPE,
+  REJECT_COUNT,       // group bigger than MAX_GROUP
+  REJECT_NOMEM,
+  REJECT_INTERRUPTED, // signal while waiting for the lock
+  NR_REJECT_REASONS
+};
+
+// operating modes picked from the traffic
+enum traffic_mode {
+  TRAFFIC_BALANCED,   // interfloor, plain LOOK
+  TRAFFIC_UP_PEAK,    // mostly up from the lobby, an idle car goes back down to it
+  TRAFFIC_DOWN_PEAK,  // mostly down to the lobby, an idle car waits at the busiest floor
+  NR_TRAFFIC_MODES
+};
+
+// hot counters, kept per cpu so bumping them never touches elev->lock.
+// only summed up when /proc/elevator_stats is read
+struct elevator_stats {
+  u64 issued;
+  u64 rejected[NR_REJECT_REASONS];
+  u64 loaded;
+  u64 unloaded;
+  u64 floors_traveled;
+  u64 stops;
+  u64 idle_ns;
+  u64 wait_ns;      // arrival to pickup, summed over loaded pets
+  u64 wait_max_ns;
+  u64 load_moved;   // current_load summed over floor moves, for utilization
+  u64 runs;         // moves of more than one floor
+  u64 runs_cut;     // ended early for a pet on a floor the car was passing
+  u64 passes_saved; // floors run past without a trip through the scheduler loop
+  u64 run_locks;    // elev->lock taken during runs, to look at new requests
+  u64 parks;        // idle runs to where the traffic mode wants the car
+  u64 mode_loaded[NR_TRAFFIC_MODES];   // wait_ns and loaded split by the mode at pickup
+  u64 mode_wait_ns[NR_TRAFFIC_MODES];
+  // estimate vs actual for requests issued with an ETA, actual - estimate
+  u64 eta_pickups;
+  u64 eta_pickup_err_ns;   // absolute error, summed
+  s64 eta_pickup_bias_ns;  // signed, > 0 means we were optimistic
+  u64 eta_deliveries;
+  u64 eta_delivery_err_ns;
+  s64 eta_delivery_bias_ns;
+};
+
+// how far the model's timing slips under host load
+enum jitter_kind {
+  JITTER_MOVE,         // a run between floors against floor_ms/cruise_ms
+  JITTER_DWELL,        // a stop against transfer_ms
+  JITTER_WAKE_WORKER,  // LOADING set until the transfer worker holds the lock
+  JITTER_WAKE_SCHED,   // transfer done until the scheduler holds the lock
+  NR_JITTER_KINDS
+};
+
+// lateness per kind, phases are timed until their thread holds elev->lock
+// again. per cpu like stats, kept apart as it's too big to copy on the stack
+struct jitter_hist {
+  u64 count[NR_JITTER_KINDS][JITTER_BUCKETS];  // bucket fls64(late us)
+  u64 late_us[NR_JITTER_KINDS];                // summed
+  u64 max_us[NR_JITTER_KINDS];
+  u64 overruns[NR_JITTER_KINDS];
+};
+
+// a group of identical pets packed into 12 bytes. waiting groups live by value
+// in their floor's ring and riding ones in the car array, so scans are sequential
+typedef struct pet_slot
+{
+  u32 id;          // tracked request (elev->tracked), 0 if nobody wants a completion
+  u32 arrival;     // ARRIVAL_TICK_MS ticks after the floor's base time (unused in the car)
+  u16 type : 2;
+  u16 dest : 3;    // destination floor - 1
+  u16 count : 11;  // pets in the group, 1..MAX_GROUP
+} pet_slot_t;
+
+// a request someone can ask about or wants a completion for
+struct pet_track {
+  __u64 tag;
+  u32 remaining;  // pets not delivered yet, a split group shares its id
+  u8 ring;        // post completions for tag on the ring
+  u8 has_eta;
+  u8 picked_up;   // first part of the group is in the car
+  u8 type;
+  u8 start_floor;
+  u8 dest_floor;
+  u8 sim_boarded;      // replay scratch, see eta_refresh
+  u32 sim_left;
+  ktime_t est_pickup;  // latest estimates from the scheduler, 0 if it has none
+  ktime_t est_delivery;
+  ktime_t eta_pickup;  // the first of them, checked against the real thing
+  ktime_t eta_delivery;
+};
+
+static const int pet_weight[NR_PET_TYPES] = { CH_WEIGHT, PU_WEIGHT, PH_WEIGHT, DA_WEIGHT };
+
+// what keeps a scheduling policy from stalling a car, one per car and a copy
+// per ETA replay. protected by elev->lock
+struct sched_guard {
+  int holds;         // decisions in a row the policy kept the car still with work elsewhere
+  int passes;        // floors in a row it wouldn't stop at with someone there who fits
+  int load_refused;  // last stop here moved nobody, no stopping to load again until the car moves
+  u64 fallbacks;     // policy answers replaced by LOOK's
+};
+
+struct traffic_switch {
+  ktime_t when;
+  u8 from;
+  u8 to;
+  u8 up_pct;    // window shares that made the call
+  u8 down_pct;
+};
+
+// recent requests and the mode they add up to, protected by elev->lock
+struct traffic {
+  u8 pairs[TRAFFIC_WINDOW];  // (start - 1) << 4 | (dest - 1), oldest at head once full
+  u32 head;
+  u32 nr;
+  int up;                    // pairs in the window starting at the lobby
+  int down;                  // and ending there
+  int origins[NUM_FLOORS];
+  enum traffic_mode mode;
+  int heavy_floor;           // most origins above the lobby
+  ktime_t since;             // mode entered
+  u32 switches;
+  struct traffic_switch history[TRAFFIC_HISTORY];  // switches % TRAFFIC_HISTORY is the next one
+};
 
 // state of elevator
 typedef enum
@@ -50,17 +280,38 @@ typedef enum
   DOWN
 } elevator_state_t;
 
-// elevator structure 
+// floor struct
+typedef struct
+{
+  pet_slot_t *waiting_queue;  // ring buffer, oldest at head
+  u32 head;
+  u32 nr_slots;               // groups, waiting_count is the pets in them
+  u32 capacity;               // power of two, 0 until the first pet arrives
+  ktime_t base;               // arrival ticks count from here
+  int waiting_count;
+} floor_t;
+
+// one elevator system: a car, its floors, threads, rings and counters.
+// systems share nothing but the module, each one runs under its own lock
 typedef struct
 {
+  u32 id;
+  atomic_t users;  // lookups in flight plus one for elevator_systems
+  int dying;       // being destroyed, the ring can't be opened. under lock
   elevator_state_t state;
   int current_floor;
   int current_load;
   int current_pets;
-  int total_serviced;
+  int car_slots; // groups in pets_in_elevator, current_pets counts the pets in them
   int direction; // 1 for UP, -1 for DOWN
+  int stopping;  // stop_elevator called, deliver what's on board then go OFFLINE
+  struct sched_guard guard;
+  int run_from;  // floor an express run started from, 0 if not running. current_floor is where it ends
+  ktime_t run_start;
+  int run_cut;   // a pet turned up on a floor the run passes
+  struct traffic traffic;
 
-  struct list_head pets_in_elevator;
+  pet_slot_t pets_in_elevator[MAX_PETS];  // car_slots in use, in load order
   struct mutex lock; // was under global but i movqed it here for clarity
   
   // multi threads 
@@ -68,34 +319,135 @@ typedef struct
   struct task_struct *transfer_worker;     
   wait_queue_head_t request_wq;            
 
-} elevator_t;
+  // shared rings, allocated for the life of the module, protected by lock
+  struct elevator_ring *ring;
+  wait_queue_head_t ring_wq;  // woken when a completion is posted
+  atomic_t ring_open;
+  atomic_t ring_maps;  // live mmaps of the ring
+  int ring_active;  // set once an open has reset the ring
+  u32 sq_head;      // next sqe to take, ring->sq_head is user writable
+  int restart;      // restored as running, started once the syscalls are hooked
 
-// floor struct
-typedef struct
-{
-  struct list_head waiting_queue;
-  int waiting_count;
-} floor_t;
+  // pet_track by id for requests that post completions
+  struct xarray tracked;
+  u32 next_track_id;
+  int eta_dirty;          // a request came in since the last eta_refresh
+  ktime_t eta_at;         // when the last replay started
+  pet_slot_t *eta_slots;  // ETA_MAX_SLOTS, the replay's copy of the queues
 
+  struct elevator_stats __percpu *stats;
+  struct wait_hist __percpu *wait_hist;  // apart from stats, which gets copied on the stack
+  struct jitter_hist __percpu *jitter;
+  ktime_t loading_at;  // handoffs between the threads not picked up yet, 0 if none
+  ktime_t idle_at;
 
-//Global variables
-static elevator_t elevator;
-static floor_t floors[NUM_FLOORS]; 
-static struct proc_dir_entry *proc_file; 
+  floor_t floors[NUM_FLOORS];
+  int waiting_by_type[NR_PET_TYPES];  // pets on all floors, for the summary view
 
-// system call handles
-extern int (*STUB_start_elevator)(void);
-extern int (*STUB_issue_request)(int, int, int);
-extern int (*STUB_stop_elevator)(void);
+  struct proc_dir_entry *proc_dir;  // /proc/elevators/<id>
+  struct miscdevice ring_dev;       // /dev/elevator_ring, elevator_ring<id> past system 0
+  char ring_name[24];
+} elevator_t;
+
+
+//Global variables
+// systems by id. system 0 is created at load, never destroyed and is the one
+// behind the original three system calls and /proc/elevator
+static DEFINE_XARRAY_ALLOC(elevator_systems);
+static DEFINE_MUTEX(elevator_systems_lock);  // create/destroy
+static elevator_t *elevator_default;
+static struct proc_dir_entry *proc_file;
+static struct proc_dir_entry *proc_systems;  // /proc/elevators
 
 // Kthread function prototypes
 static int scheduler_thread_run(void *data);
 static int transfer_worker_run(void *data);
 
-// Helper function to safely remove and free a pet
-static void remove_and_free_pet(pet_t *pet_to_remove) {
-    list_del(&pet_to_remove->list); 
-    kfree(pet_to_remove); 
+// invariant checks run by the KUnit suite, called with elev->lock held
+#ifdef ELEVATOR_KUNIT_TEST
+static void elevator_test_check(elevator_t *elev, bool moving);
+#else
+static inline void elevator_test_check(elevator_t *elev, bool moving) { }
+#endif
+
+// sleep for one of the model delays, msleep is too coarse below a few jiffies
+static void elevator_delay(unsigned int ms) {
+    if (ms >= 20) msleep(ms);
+    else usleep_range(ms * USEC_PER_MSEC, ms * USEC_PER_MSEC + 100);
+}
+
+// a phase begun at *start that should have taken intended_us is over, the
+// caller holds elev->lock again. nothing if *start is 0, which it's reset to
+static void jitter_record(elevator_t *elev, enum jitter_kind kind, ktime_t *start, u64 intended_us) {
+    struct jitter_hist *h;
+    u64 actual_us, late_us;
+
+    if (!*start) return;
+    actual_us = ktime_us_delta(ktime_get(), *start);
+    *start = 0;
+    late_us = actual_us > intended_us ? actual_us - intended_us : 0;
+
+    // one cpu for the whole update, the max is a read-then-write
+    h = get_cpu_ptr(elev->jitter);
+    h->count[kind][min(fls64(late_us), JITTER_BUCKETS - 1)]++;
+    h->late_us[kind] += late_us;
+    if (late_us > h->max_us[kind]) h->max_us[kind] = late_us;
+    if (late_us > (intended_us ? div_u64(intended_us * JITTER_OVERRUN_PCT, 100) : JITTER_WAKE_OVERRUN_US))
+        h->overruns[kind]++;
+    put_cpu_ptr(elev->jitter);
+}
+
+// stop a thread started by start_elevator_handler and drop our reference.
+// the reference keeps this safe when the thread has already exited by itself
+static void reap_thread(struct task_struct *task) {
+    if (!task) return;
+    kthread_stop(task);
+    put_task_struct(task);
+}
+
+// i-th waiting pet on a floor, counting from the oldest
+static pet_slot_t *floor_slot(floor_t *floor, u32 i) {
+    return &floor->waiting_queue[(floor->head + i) & (floor->capacity - 1)];
+}
+
+// double a floor's ring, unwrapping it to start at 0
+static int floor_grow(floor_t *floor) {
+    u32 capacity = floor->capacity ? floor->capacity * 2 : FLOOR_RING_MIN;
+    pet_slot_t *slots = kvmalloc_array(capacity, sizeof(*slots), GFP_KERNEL);
+
+    if (!slots) return -ENOMEM;
+    for (u32 i = 0; i < floor->nr_slots; i++) slots[i] = *floor_slot(floor, i);
+    kvfree(floor->waiting_queue);
+    floor->waiting_queue = slots;
+    floor->head = 0;
+    floor->capacity = capacity;
+    return 0;
+}
+
+// arrival in ticks after the floor's base time. 32 bits of ticks is over a year,
+// should a floor never empty for that long the base moves up and pets older
+// than the new base read as arriving at it
+static u32 floor_arrival_ticks(floor_t *floor, ktime_t arrival) {
+    s64 ticks;
+
+    if (floor->nr_slots == 0) floor->base = arrival;
+    ticks = ktime_ms_delta(arrival, floor->base) / ARRIVAL_TICK_MS;
+    if (ticks < 0) return 0;
+    if (ticks > U32_MAX) {
+        u32 shift = ticks - U32_MAX / 2;
+
+        for (u32 i = 0; i < floor->nr_slots; i++) {
+            pet_slot_t *slot = floor_slot(floor, i);
+            slot->arrival = slot->arrival > shift ? slot->arrival - shift : 0;
+        }
+        floor->base = ktime_add_ms(floor->base, (u64)shift * ARRIVAL_TICK_MS);
+        ticks -= shift;
+    }
+    return ticks;
+}
+
+static ktime_t slot_arrival(floor_t *floor, pet_slot_t *slot) {
+    return ktime_add_ms(floor->base, (u64)slot->arrival * ARRIVAL_TICK_MS);
 }
 
 // helper to get the character code for printing
@@ -109,407 +461,2352 @@ static char get_pet_char(int type) {
     }
 }
 
+static const char *elevator_state_name(elevator_state_t state) {
+    switch (state) {
+        case OFFLINE: return "OFFLINE";
+        case IDLE:    return "IDLE";
+        case LOADING: return "LOADING";
+        case UP:      return "UP";
+        case DOWN:    return "DOWN";
+        default:      return "UNKNOWN";
+    }
+}
+
 // helper function to check if any pets are waiting in the entire building
-static int are_pets_waiting(void) {
+static int are_pets_waiting(elevator_t *elev) {
     for (int i = 0; i < NUM_FLOORS; i++) {
-        if (floors[i].waiting_count > 0) return 1;
+        if (elev->floors[i].waiting_count > 0) return 1;
     }
     return 0;
 }
 
+// how many pets of a waiting group the car can take on top of pets/load
+static int pets_that_fit(const pet_slot_t *pet, int pets, int load) {
+    return min3((int)pet->count, MAX_PETS - pets, (MAX_WEIGHT - load) / pet_weight[pet->type]);
+}
 
-//do all the start, request, stop handlers
-int start_elevator_handler(void)
-{
-    if (mutex_lock_interruptible(&elevator.lock)) return -ERESTARTSYS; //added error handling
+// scheduling policy: LOOK unless a BPF struct_ops program is attached
+// (elevator_sched.h). one policy for every system. the car and the ETA replay
+// both decide through the sched_* calls on a view of their state, so a
+// policy's estimates follow the policy
+static_assert(NUM_FLOORS == ELEVATOR_SCHED_FLOORS);
 
-    if (elevator.state != OFFLINE) { // Already running
-        mutex_unlock(&elevator.lock);
-        return 1;
-    }
-    
-    // Start multiple threads
-    elevator.scheduler_thread = kthread_run(scheduler_thread_run, NULL, "elev_scheduler");
-    elevator.transfer_worker = kthread_run(transfer_worker_run, NULL, "elev_transfer");
-    
-    //whole error handling for threads
-    if (IS_ERR(elevator.scheduler_thread) || IS_ERR(elevator.transfer_worker)) {
-        if (elevator.scheduler_thread && !IS_ERR(elevator.scheduler_thread)) kthread_stop(elevator.scheduler_thread);
-        if (elevator.transfer_worker && !IS_ERR(elevator.transfer_worker)) kthread_stop(elevator.transfer_worker);
-        elevator.scheduler_thread = NULL;
-        elevator.transfer_worker = NULL;
-        mutex_unlock(&elevator.lock);
-        return -ENOMEM;
-    }
+static struct elevator_sched_ops __rcu *elevator_sched;
 
-    elevator.state = IDLE;
-    elevator.current_floor = 1;
-    elevator.direction = 1; // Start going UP
-    mutex_unlock(&elevator.lock);
-    return 0;
+// how long a policy may keep the car still, or keep passing floors where
+// someone would fit, before LOOK's answer is taken instead
+#define SCHED_MAX_HOLDS 8
+
+// view of a car, everything but the waiting counts and fits_here
+static void sched_view_init(struct elevator_sched_view *view, const pet_slot_t *car, int car_slots,
+                            int pets, int load, int floor, int direction, int stopping) {
+    memset(view, 0, sizeof(*view));
+    view->current_floor = floor;
+    view->direction = direction;
+    view->current_load = load;
+    view->current_pets = pets;
+    view->stopping = stopping;
+    for (int i = 0; i < car_slots; i++) view->riding_to[car[i].dest] += car[i].count;
 }
 
-int issue_request_handler(int start_floor, int dest_floor, int type)
-{
-    if (start_floor < MIN_FLOOR || start_floor > MAX_FLOOR) return 1;
-    if (dest_floor < MIN_FLOOR || dest_floor > MAX_FLOOR) return 1;
-    if (start_floor == dest_floor) return 1;
-    if (type < CH_TYPE || type > DA_TYPE) return 1;
-
-    pet_t *new_pet = kmalloc (sizeof(pet_t), GFP_KERNEL);
-    if (!new_pet) return -ENOMEM;
-
-    new_pet->type = type;
-    new_pet->start_floor = start_floor;
-    new_pet->dest_floor = dest_floor;
-
-     switch (type){
-    case CH_TYPE: new_pet -> weight = CH_WEIGHT; break;
-    case PU_TYPE: new_pet -> weight = PU_WEIGHT; break;
-    case PH_TYPE: new_pet -> weight = PH_WEIGHT; break;
-    case DA_TYPE: new_pet -> weight = DA_WEIGHT; break;
-    }//end of switch
-    
-    int floor_idx = start_floor - 1;
+// the real car, caller holds elev->lock
+// someone waiting on floor could get on the car as it is loaded now
+static bool floor_fits_car(elevator_t *elev, int floor_nr) {
+    floor_t *floor = &elev->floors[floor_nr - 1];
 
-    if (mutex_lock_interruptible(&elevator.lock)) {
-        kfree(new_pet);
-        return -ERESTARTSYS;
+    if (elev->stopping || elev->current_pets >= MAX_PETS) return false;
+    for (u32 i = 0; i < floor->nr_slots; i++) {
+        if (elev->current_load + pet_weight[floor_slot(floor, i)->type] <= MAX_WEIGHT) return true;
     }
+    return false;
+}
 
-    list_add_tail(&new_pet->list, &floors[floor_idx].waiting_queue); 
-    floors[floor_idx].waiting_count++;
-    
-    // Wake up the scheduler thread since new work arrived
-    wake_up_interruptible(&elevator.request_wq);
-    
-    mutex_unlock(&elevator.lock);
-    return 0;
-} //end of issue request handlet
+static void sched_view_elevator(elevator_t *elev, struct elevator_sched_view *view) {
+    sched_view_init(view, elev->pets_in_elevator, elev->car_slots, elev->current_pets,
+                    elev->current_load, elev->current_floor, elev->direction, elev->stopping);
+    for (int i = 0; i < NUM_FLOORS; i++) view->waiting[i] = elev->floors[i].waiting_count;
+    view->fits_here = floor_fits_car(elev, elev->current_floor);
+}
 
-int stop_elevator_handler(void)
-{
-    int stop_requested = 0;
-    
-    if (mutex_lock_interruptible(&elevator.lock))
-        return -ERESTARTSYS; 
+// fit of them boarded, keep the view current for the next group offered
+static void sched_view_board(struct elevator_sched_view *view, const pet_slot_t *pet, int fit) {
+    view->current_pets += fit;
+    view->current_load += pet_weight[pet->type] * fit;
+    view->riding_to[pet->dest] += fit;
+    view->waiting[view->current_floor - 1] -= fit;
+}
 
-    if (elevator.state == OFFLINE) {
-        stop_requested = 1;
-    } else {
-        elevator.state = OFFLINE;
-        
-        // Wake up scheduler so it can check state and exit
-        wake_up_interruptible(&elevator.request_wq); 
-        
-        stop_requested = 0;
+// LOOK: keep going while there is a rider's floor or a waiting pet ahead,
+// turn around when there isn't. waiting pets don't count once stopping
+static int look_next_direction(const struct elevator_sched_view *view) {
+    int above = 0, below = 0, direction = view->direction;
+
+    for (int i = 0; i < NUM_FLOORS; i++) {
+        if (!view->riding_to[i] && (view->stopping || !view->waiting[i])) continue;
+        if (i + 1 > view->current_floor) above = 1;
+        if (i + 1 < view->current_floor) below = 1;
     }
-    
-    mutex_unlock(&elevator.lock);
-    return stop_requested;
+
+    if (direction == 1 && (view->current_floor == MAX_FLOOR || !above)) direction = -1;
+    else if (direction == -1 && (view->current_floor == MIN_FLOOR || !below)) direction = 1;
+
+    if ((direction == 1 && above) || (direction == -1 && below)) return direction;
+    return 0;
 }
 
+// where to move next. an answer off the building, or keeping the car still
+// more than SCHED_MAX_HOLDS times in a row while LOOK would move, is overridden
+static int sched_next_direction(struct sched_guard *guard, struct elevator_sched_view *view) {
+    struct elevator_sched_ops *ops;
+    int look = look_next_direction(view);
+    int direction = look;
 
-// add kthread implememntation with a thread function and a proc file implementation
-// Part 3f: LOOK Scheduling Algorithm
+    rcu_read_lock();
+    ops = rcu_dereference(elevator_sched);
+    if (ops && ops->next_direction) {
+        int next = ops->next_direction(view);
+        int floor = view->current_floor + next;
 
-// --- TRANSFER WORKER THREAD (Role: Execute Loading/Unloading and 1s Delay) ---
-static int transfer_worker_run(void *data)
-{
-    pet_t *pet, *next; 
-    
-    while (!kthread_should_stop()) {
-        set_current_state(TASK_INTERRUPTIBLE); // Sleep until woken
-        schedule();
+        if (next < -1 || next > 1 || floor < MIN_FLOOR || floor > MAX_FLOOR) guard->fallbacks++;
+        else if (next == 0 && look && ++guard->holds > SCHED_MAX_HOLDS) guard->fallbacks++;
+        else direction = next;
+    }
+    rcu_read_unlock();
 
-        if (kthread_should_stop()) break; // Exit if requested
-        
-        if (mutex_lock_interruptible(&elevator.lock)) return -ERESTARTSYS; 
+    // the caller moves the car
+    if (direction) {
+        guard->holds = 0;
+        guard->load_refused = 0;
+    }
+    return direction;
+}
 
-        // check if loading 
-        if (elevator.state == LOADING) {
-            int floor_idx = elevator.current_floor - 1;
-            
-            // Step 1: UNLOAD pets at current floor
-            list_for_each_entry_safe(pet, next, &elevator.pets_in_elevator, list) {
-                if (pet->dest_floor == elevator.current_floor) {
-                    remove_and_free_pet(pet);
-                    elevator.current_pets--;
-                    elevator.current_load -= pet->weight;
-                    elevator.total_serviced++;
-                }
-            }
-            
-            // Step 2: LOAD pets at current floor (FIFO with constraints)
-            list_for_each_entry_safe(pet, next, &floors[floor_idx].waiting_queue, list) {
-                // Check capacity constraints
-                if (elevator.current_pets >= MAX_PETS) break;
-                if (elevator.current_load + pet->weight > MAX_WEIGHT) continue;
-
-                list_move_tail(&pet->list, &elevator.pets_in_elevator); 
-                
-                elevator.current_pets++;
-                elevator.current_load += pet->weight;
-                floors[floor_idx].waiting_count--;
-            }
-        }
-        
-        // unlock mutex and then sleep for 1 second to load or unload
-        mutex_unlock(&elevator.lock);
-        ssleep(1); // 1.0 second delay for transfer 
-        
-        // 3. Reacquire lock to safely update state and wake scheduler
-        if (mutex_lock_interruptible(&elevator.lock)) return -ERESTARTSYS;
-        
-        // Transfer is complete, return control to scheduler
-        elevator.state = IDLE; 
-        wake_up_interruptible(&elevator.request_wq); 
+// stop to load here? only asked when a waiting pet would fit and nobody gets
+// off. passing more than SCHED_MAX_HOLDS such floors in a row forces a stop
+static bool sched_should_stop(struct sched_guard *guard, struct elevator_sched_view *view) {
+    struct elevator_sched_ops *ops;
+    bool stop = true;
 
-        mutex_unlock(&elevator.lock);
+    if (guard->load_refused) return false;
+    rcu_read_lock();
+    ops = rcu_dereference(elevator_sched);
+    if (ops && ops->should_stop && !ops->should_stop(view)) {
+        if (++guard->passes <= SCHED_MAX_HOLDS) stop = false;
+        else guard->fallbacks++;
     }
-    return 0;
+    rcu_read_unlock();
+    return stop;
 }
 
+// a stop is over, moved is how many pets got on or off
+static void sched_stopped(struct sched_guard *guard, int moved) {
+    guard->passes = 0;
+    guard->load_refused = moved == 0;
+}
 
-// --- SCHEDULER THREAD (Role: Movement and State Control) ---
-static int scheduler_thread_run(void *data)
-{
-    pet_t *pet;
-    
-    while (!kthread_should_stop()) {
-        
-        // 1. Wait for work: blocks until new work arrives or checks every 1 sec
-        wait_event_interruptible_timeout(elevator.request_wq, 
-                                         elevator.state != IDLE || elevator.current_pets > 0 || are_pets_waiting(), 
-                                         msecs_to_jiffies(1000));
-        
-        if (mutex_lock_interruptible(&elevator.lock)) return -ERESTARTSYS; 
+// floors to cover in one go in direction: up to the first floor with a rider
+// to drop off or a pet waiting, LOOK does nothing at the ones in between.
+// floor by floor while a policy is attached, it gets a say at every floor
+static int sched_run_length(struct elevator_sched_view *view, int direction) {
+    int floor = view->current_floor + direction;
 
-	//added this to top
-	if (elevator.state == LOADING){
+    if (rcu_access_pointer(elevator_sched)) return 1;
+    while (floor + direction >= MIN_FLOOR && floor + direction <= MAX_FLOOR) {
+        if (view->riding_to[floor - 1] || (!view->stopping && view->waiting[floor - 1])) break;
+        floor += direction;
+    }
+    return (floor - view->current_floor) * direction;
+}
 
-            mutex_unlock(&elevator.lock);
+// travel time of a run: the first floor at floor_ms, the rest at cruise_ms
+static u64 run_ms(int floors) {
+    unsigned int cruise = cruise_ms ?: floor_ms;
 
-            wait_event_interruptible(elevator.request_wq, elevator.state 
-		!= LOADING || kthread_should_stop());
-            if (mutex_lock_interruptible(&elevator.lock)) return -ERESTARTSYS;
-	}
+    return floors > 0 ? floor_ms + (u64)(floors - 1) * cruise : 0;
+}
 
+// how many of a waiting group get on, LOOK takes as many as fit
+static int sched_pets_to_load(struct elevator_sched_view *view, const pet_slot_t *pet) {
+    struct elevator_sched_ops *ops;
+    int fit = pets_that_fit(pet, view->current_pets, view->current_load);
 
-        // if elevator is OFFLINE and empty, exit thread
-        if (elevator.state == OFFLINE && elevator.current_pets == 0) {
-             mutex_unlock(&elevator.lock);
-             // Also stop worker thread on final exit
-             if (elevator.transfer_worker) kthread_stop(elevator.transfer_worker);
-             break; 
-        }
+    if (fit <= 0) return 0;
+    rcu_read_lock();
+    ops = rcu_dereference(elevator_sched);
+    if (ops && ops->pets_to_load)
+        fit = clamp(ops->pets_to_load(view, pet->type, pet->dest + 1, pet->count), 0, fit);
+    rcu_read_unlock();
+    return fit;
+}
 
-        // check if idle
-        if (elevator.current_pets == 0 && !are_pets_waiting()) {
-            elevator.state = IDLE;
-            mutex_unlock(&elevator.lock);
-            continue; // Go back to wait queue
-        }
+static void count_reject(elevator_t *elev, enum reject_reason reason) {
+    this_cpu_inc(elev->stats->rejected[reason]);
+}
 
-        // 2. TRANSFER LOGIC (Loading/Unloading)
-        int needs_transfer = 0;
-        
-        // Check pets in elevator need moving
-        list_for_each_entry(pet, &elevator.pets_in_elevator, list) {
-            if (pet->dest_floor == elevator.current_floor) { needs_transfer = 1; break; }
-        }
-        // Check for Load
-        if (floors[elevator.current_floor - 1].waiting_count > 0) {
-		
-		list_for_each_entry(pet, &floors[elevator.current_floor -1].waiting_queue, list) {
-		 if (elevator.current_pets < MAX_PETS && elevator.current_load + pet->weight <= MAX_WEIGHT) 
-			{ needs_transfer = 1; 
-				break; }} 
-	}
+// returns 0 if the request is valid, 1 otherwise (same as issue_request)
+static int check_request(elevator_t *elev, int start_floor, int dest_floor, int type, int count) {
+    this_cpu_inc(elev->stats->issued);
 
+    if (start_floor < MIN_FLOOR || start_floor > MAX_FLOOR) { count_reject(elev, REJECT_FLOOR); return 1; }
+    if (dest_floor < MIN_FLOOR || dest_floor > MAX_FLOOR) { count_reject(elev, REJECT_FLOOR); return 1; }
+    if (start_floor == dest_floor) { count_reject(elev, REJECT_SAME_FLOOR); return 1; }
+    if (type < CH_TYPE || type > DA_TYPE) { count_reject(elev, REJECT_TYPE); return 1; }
+    if (count < 1 || count > MAX_GROUP) { count_reject(elev, REJECT_COUNT); return 1; }
+    return 0;
+}
 
-        if (needs_transfer) {
-            elevator.state = LOADING;
-            wake_up_process(elevator.transfer_worker); // Signal worker to handle transfer
+// add an already checked group to its floor queue as one slot and kick the
+// scheduler, caller holds elev->lock
+static int queue_pet(elevator_t *elev, int start_floor, int dest_floor, int type, int count, u32 id, ktime_t arrival) {
+    floor_t *floor = &elev->floors[start_floor - 1];
+    pet_slot_t *slot;
 
-            mutex_unlock(&elevator.lock);
-            continue; // Wait for worker to signal back
-        }
+    if (floor->nr_slots == floor->capacity && floor_grow(floor)) return -ENOMEM;
 
-        // Step 4: LOOK Algorithm - Check for requests in current direction
-        int has_requests_above = 0;
-        int has_requests_below = 0;
-        
-        // Check pets in elevator
-        list_for_each_entry(pet, &elevator.pets_in_elevator, list) {
-            if (pet->dest_floor > elevator.current_floor) has_requests_above = 1;
-            if (pet->dest_floor < elevator.current_floor) has_requests_below = 1;
-        }
-        // Check waiting pets on floors
-        for (int i = 0; i < NUM_FLOORS; i++) {
-            if (floors[i].waiting_count > 0) {
-                if ((i + 1) > elevator.current_floor) has_requests_above = 1;
-                if ((i + 1) < elevator.current_floor) has_requests_below = 1;
-            }
-        }
+    u32 ticks = floor_arrival_ticks(floor, arrival);
+    slot = floor_slot(floor, floor->nr_slots++);
+    slot->id = id;
+    slot->arrival = ticks;
+    slot->type = type;
+    slot->dest = dest_floor - 1;
+    slot->count = count;
+    floor->waiting_count += count;
+    elev->waiting_by_type[type] += count;
 
-        // tried to simplify movement logic
-        if (elevator.direction == 1) { // UP
-            if (elevator.current_floor == MAX_FLOOR || !has_requests_above) {
-                elevator.direction = -1; // Reverse if at top or no requests above
-            }
-        } else { // DOWN (-1)
-            if (elevator.current_floor == MIN_FLOOR || !has_requests_below) {
-                elevator.direction = 1; // Reverse if at bottom or no requests below
-            }
-        }
-        
-        // Execute Movement:
-        if ((elevator.direction == 1 && has_requests_above) || (elevator.direction == -1 && has_requests_below)) {
-            elevator.state = (elevator.direction == 1) ? UP : DOWN;
-            elevator.current_floor += elevator.direction;
-            
-            mutex_unlock(&elevator.lock);
-            ssleep(2); // 2.0 seconds between floors
-            continue;
-        }
+    // the car is running past this floor and could take the pet, it may
+    // still be able to stop
+    if (elev->run_from && (start_floor - elev->run_from) * elev->direction > 0 &&
+        (elev->current_floor - start_floor) * elev->direction > 0 && floor_fits_car(elev, start_floor))
+        elev->run_cut = 1;
+    // it may cut in ahead of someone's estimate
+    if (!xa_empty(&elev->tracked)) elev->eta_dirty = 1;
+    
+    // Wake up the scheduler thread since new work arrived
+    wake_up_interruptible(&elev->request_wq);
+    return 0;
+}
 
-        // unlock the mutex if no movement was made
-        mutex_unlock(&elevator.lock);
-        ssleep(1); // Small sleep if logic failed to find immediate movement
+static const char *traffic_mode_name(enum traffic_mode mode) {
+    switch (mode) {
+    case TRAFFIC_UP_PEAK: return "up-peak";
+    case TRAFFIC_DOWN_PEAK: return "down-peak";
+    default: return "balanced";
     }
-    return 0;
 }
 
+// switch modes on the window's shares, with the gap between
+// TRAFFIC_ENTER_PCT and TRAFFIC_LEAVE_PCT as hysteresis
+static void traffic_classify(elevator_t *elev) {
+    struct traffic *tr = &elev->traffic;
+    enum traffic_mode mode = tr->mode;
+    int up = tr->up * 100 / tr->nr;
+    int down = tr->down * 100 / tr->nr;
 
-// proc file implementation to show elevator status
-static int elevator_proc_show(struct seq_file *m, void *v) {
-    struct list_head *temp;
-    pet_t *pet;
-    int total_waiting = 0;
-    
-    if (mutex_lock_interruptible(&elevator.lock)) return -ERESTARTSYS; 
-
-    // --- A. Print Elevator Status ---
-    const char *state_str;
-    switch(elevator.state) {
-        case OFFLINE: state_str = "OFFLINE"; break;
-        case IDLE:    state_str = "IDLE"; break;
-        case LOADING: state_str = "LOADING"; break;
-        case UP:      state_str = "UP"; break;
-        case DOWN:    state_str = "DOWN"; break;
-        default:      state_str = "UNKNOWN";
+    tr->heavy_floor = MIN_FLOOR + 1;
+    for (int i = MIN_FLOOR; i < NUM_FLOORS; i++) {
+        if (tr->origins[i] > tr->origins[tr->heavy_floor - 1]) tr->heavy_floor = i + 1;
     }
-    
-    seq_printf(m, "Elevator state: %s\n", state_str);
-    seq_printf(m, "Current floor: %d\n", elevator.current_floor);
-    seq_printf(m, "Current load: %d lbs\n", elevator.current_load);
-    
-    seq_printf(m, "Elevator status:");
-    list_for_each(temp, &elevator.pets_in_elevator) {
-        pet = list_entry(temp, pet_t, list);
-        seq_printf(m, " %c%d", get_pet_char(pet->type), pet->dest_floor);
+    if (tr->nr < TRAFFIC_MIN_SAMPLES) return;
+
+    if (mode == TRAFFIC_UP_PEAK && up < TRAFFIC_LEAVE_PCT) mode = TRAFFIC_BALANCED;
+    if (mode == TRAFFIC_DOWN_PEAK && down < TRAFFIC_LEAVE_PCT) mode = TRAFFIC_BALANCED;
+    if (mode == TRAFFIC_BALANCED) {
+        if (up >= TRAFFIC_ENTER_PCT) mode = TRAFFIC_UP_PEAK;
+        else if (down >= TRAFFIC_ENTER_PCT) mode = TRAFFIC_DOWN_PEAK;
     }
-    seq_printf(m, "\n\n");
-    
-    // --- B. Print Floor Status ---
-    for (int i = NUM_FLOORS -1; i >= 0; i--) {
-        seq_printf(m, "[%c] Floor %d: %d ", 
-                   (elevator.current_floor == i + 1) ? '*' : ' ', 
-                   i + 1, 
-                   floors[i].waiting_count);
-        
-        list_for_each(temp, &floors[i].waiting_queue) {
-            pet = list_entry(temp, pet_t, list);
-            seq_printf(m, "%c%d ", get_pet_char(pet->type), pet->dest_floor);
-        }
-        seq_printf(m, "\n");
-        total_waiting += floors[i].waiting_count;
+    if (mode == tr->mode) return;
+
+    tr->history[tr->switches++ % TRAFFIC_HISTORY] = (struct traffic_switch){
+        .when = ktime_get(), .from = tr->mode, .to = mode, .up_pct = up, .down_pct = down,
+    };
+    tr->mode = mode;
+    tr->since = ktime_get();
+}
+
+// one more request in the window, the oldest drops out once it's full.
+// caller holds elev->lock
+static void traffic_record(elevator_t *elev, int start_floor, int dest_floor) {
+    struct traffic *tr = &elev->traffic;
+
+    if (tr->nr == TRAFFIC_WINDOW) {
+        u8 old = tr->pairs[tr->head];
+
+        tr->up -= (old >> 4) + 1 == MIN_FLOOR;
+        tr->down -= (old & 0xf) + 1 == MIN_FLOOR;
+        tr->origins[old >> 4]--;
+    } else {
+        tr->nr++;
     }
-    
-    // --- C. Print Overall Counts ---
-    seq_printf(m, "\nNumber of pets waiting: %d\n", total_waiting);
-    seq_printf(m, "Number of pets serviced: %d\n", elevator.total_serviced);
-    
-    mutex_unlock(&elevator.lock); 
-    return 0;
+    tr->pairs[tr->head] = (start_floor - 1) << 4 | (dest_floor - 1);
+    tr->head = (tr->head + 1) % TRAFFIC_WINDOW;
+    tr->up += start_floor == MIN_FLOOR;
+    tr->down += dest_floor == MIN_FLOOR;
+    tr->origins[start_floor - 1]++;
+    traffic_classify(elev);
 }
 
-static int elevator_proc_open(struct inode *inode, struct file *file) {
-    return single_open(file, elevator_proc_show, NULL);
+// where an idle car should wait in the current mode, 0 to stay put. an
+// attached scheduling policy runs the car on its own
+static int traffic_park_floor(elevator_t *elev) {
+    if (rcu_access_pointer(elevator_sched)) return 0;
+    switch (elev->traffic.mode) {
+    case TRAFFIC_UP_PEAK: return MIN_FLOOR;
+    case TRAFFIC_DOWN_PEAK: return elev->traffic.heavy_floor;
+    default: return 0;
+    }
 }
 
-static const struct proc_ops elevator_proc_ops = {
-    .proc_open    = elevator_proc_open,
-    .proc_read    = seq_read,
-    .proc_lseek   = seq_lseek,
-    .proc_release = single_release,
-};
+// give a request of count pets an id, the caller fills in the rest.
+// caller holds elev->lock
+static struct pet_track *track_request(elevator_t *elev, int start_floor, int dest_floor, int type, int count, u32 *id) {
+    struct pet_track *track = kzalloc(sizeof(*track), GFP_KERNEL);
 
-// modukle entry and exit
-static int __init elevator_init(void)
-{
-    // intiailizing mutxes(part3e)
-    mutex_init(&elevator.lock); 
-    init_waitqueue_head(&elevator.request_wq);
-
-    //initializing the elevator
-    elevator.state = OFFLINE;
-    elevator.current_floor = 1;
-    elevator.current_load = 0;
-    elevator.current_pets = 0;
-    elevator.total_serviced = 0;
-    elevator.scheduler_thread = NULL; // added these two lines 
-    elevator.transfer_worker = NULL;
-    INIT_LIST_HEAD (&elevator.pets_in_elevator);
-
-    //intializing the floors
-    for(int i = 0; i < NUM_FLOORS; i++){
-      INIT_LIST_HEAD(&floors[i].waiting_queue);
-      floors[i].waiting_count = 0;
-    }// end of for loop
-
-    STUB_start_elevator = start_elevator_handler;
-    STUB_issue_request = issue_request_handler;
-    STUB_stop_elevator = stop_elevator_handler;
-    
-    //create /proc entry
-    proc_file = proc_create(PROC_FILENAME, 0666, NULL, &elevator_proc_ops);
-    if (!proc_file) {
-        return -ENOMEM;
+    if (!track) return NULL;
+    track->remaining = count;
+    track->start_floor = start_floor;
+    track->dest_floor = dest_floor;
+    track->type = type;
+    if (xa_alloc_cyclic(&elev->tracked, id, track, xa_limit_32b, &elev->next_track_id, GFP_KERNEL) < 0) {
+        kfree(track);
+        return NULL;
     }
+    return track;
+}
 
-  //  printk(KERN_INFO "Elevator module initialized and syscall stubs linked.\n");
-    return 0;
+// drop tracked requests (only the ring's if ring_only), the ids left in slots
+// then resolve to nothing
+static void untrack_all(elevator_t *elev, bool ring_only) {
+    struct pet_track *track;
+    unsigned long id;
+
+    xa_for_each(&elev->tracked, id, track) {
+        if (ring_only && !track->ring) continue;
+        xa_erase(&elev->tracked, id);
+        kfree(track);
+    }
 }
 
-static void __exit elevator_exit(void)
-{
-    struct list_head *temp, *next;
-    
-    //stop thread part 3c
-    if (elevator.scheduler_thread) kthread_stop(elevator.scheduler_thread);
-    if (elevator.transfer_worker) kthread_stop(elevator.transfer_worker);
+// actual - estimate into the per cpu sums
+static void eta_account(ktime_t eta, ktime_t now, u64 *samples, u64 *err_ns, s64 *bias_ns) {
+    s64 err = ktime_to_ns(ktime_sub(now, eta));
 
-    // remove /proc entry
-    remove_proc_entry(PROC_FILENAME, NULL);
-    
-    STUB_start_elevator = NULL;
-    STUB_issue_request = NULL;
-    STUB_stop_elevator = NULL;
-    
-    list_for_each_safe(temp, next, &elevator.pets_in_elevator) {
-        remove_and_free_pet(list_entry(temp, pet_t, list)); // changed to remove and free for error checking
+    (*samples)++;
+    *err_ns += abs(err);
+    *bias_ns += err;
+}
+
+// a tracked pet was loaded, caller holds elev->lock
+static void pickup_tracked(elevator_t *elev, u32 id, ktime_t now) {
+    struct pet_track *track = xa_load(&elev->tracked, id);
+    struct elevator_stats *stats;
+
+    if (!track || track->picked_up) return;
+    track->picked_up = 1;
+    if (!track->has_eta) return;
+    stats = get_cpu_ptr(elev->stats);
+    eta_account(track->eta_pickup, now, &stats->eta_pickups, &stats->eta_pickup_err_ns, &stats->eta_pickup_bias_ns);
+    put_cpu_ptr(elev->stats);
+}
+
+// post a completion to the ring, caller holds elev->lock
+static void ring_post_completion(elevator_t *elev, __u64 tag, int event, int result) {
+    struct elevator_ring *ring = elev->ring;
+    __u32 tail = ring->cq_tail;
+
+    // the consumer is too far behind, count it so they can tell
+    if (tail - smp_load_acquire(&ring->cq_head) >= RING_CQ_ENTRIES) {
+        ring->cq_overflow++;
+        return;
     }
-    for (int i = 0; i < NUM_FLOORS; i++) {
-        list_for_each_safe (temp, next, &floors[i].waiting_queue) {
-            remove_and_free_pet(list_entry(temp, pet_t, list));
-        }
+
+    ring->cqes[tail & (RING_CQ_ENTRIES - 1)].tag = tag;
+    ring->cqes[tail & (RING_CQ_ENTRIES - 1)].event = event;
+    ring->cqes[tail & (RING_CQ_ENTRIES - 1)].result = result;
+    smp_store_release(&ring->cq_tail, tail + 1);
+    wake_up_interruptible(&elev->ring_wq);
+}
+
+// delivered pets of a tracked request, the completion goes out with the
+// last of them. caller holds elev->lock
+static void complete_tracked(elevator_t *elev, u32 id, int delivered, ktime_t now) {
+    struct pet_track *track = xa_load(&elev->tracked, id);
+
+    if (!track) return;
+    if (track->remaining > delivered) {
+        track->remaining -= delivered;
+        return;
     }
+    xa_erase(&elev->tracked, id);
+    if (track->has_eta) {
+        struct elevator_stats *stats = get_cpu_ptr(elev->stats);
 
-    mutex_destroy(&elevator.lock);
+        eta_account(track->eta_delivery, now, &stats->eta_deliveries, &stats->eta_delivery_err_ns,
+                    &stats->eta_delivery_bias_ns);
+        put_cpu_ptr(elev->stats);
+    }
+    if (track->ring) ring_post_completion(elev, track->tag, RING_EVENT_DELIVERED, 0);
+    kfree(track);
 }
 
+// queue up to RING_DRAIN_BATCH submissions, caller holds elev->lock. the
+// scheduler comes back for the rest, so a full ring never holds the lock
+// for long. the head lives in elev, ring->sq_head is only a copy for the
+// producer
+static void ring_drain_submissions(elevator_t *elev) {
+    struct elevator_ring *ring = elev->ring;
+    __u32 head = elev->sq_head, tail;
+    int budget = RING_DRAIN_BATCH;
+
+    if (!elev->ring_active) return;
+
+    tail = smp_load_acquire(&ring->sq_tail);
+    // a tail that runs past the ring can only come from a confused producer
+    if (tail - head > RING_SQ_ENTRIES) head = tail - RING_SQ_ENTRIES;
+
+    while (head != tail && budget--) {
+        struct elevator_sqe *sqe = &ring->sqes[head & (RING_SQ_ENTRIES - 1)];
+        // copy out once, userspace can rewrite the slot under us
+        int start_floor = READ_ONCE(sqe->start_floor);
+        int dest_floor = READ_ONCE(sqe->dest_floor);
+        int type = READ_ONCE(sqe->type);
+        int count = READ_ONCE(sqe->count) ?: 1;
+        __u64 tag = READ_ONCE(sqe->tag);
+        int result = check_request(elev, start_floor, dest_floor, type, count);
+
+        if (result == 0) {
+            struct pet_track *track;
+            u32 id;
+
+            // no ETA, ring producers get completions instead
+            track = track_request(elev, start_floor, dest_floor, type, count, &id);
+            if (!track) {
+                result = -ENOMEM;
+            } else {
+                track->tag = tag;
+                track->ring = 1;
+                if (queue_pet(elev, start_floor, dest_floor, type, count, id, ktime_get())) {
+                    kfree(xa_erase(&elev->tracked, id));
+                    result = -ENOMEM;
+                } else {
+                    traffic_record(elev, start_floor, dest_floor);
+                }
+            }
+            if (result) count_reject(elev, REJECT_NOMEM);
+        }
+        ring_post_completion(elev, tag, RING_EVENT_ACCEPTED, result);
+        head++;
+    }
+    WRITE_ONCE(elev->sq_head, head);
+    smp_store_release(&ring->sq_head, head);
+
+    // more left, the scheduler sees ring_pending and is back for them
+    if (head != tail) {
+        WRITE_ONCE(ring->flags, 0);
+        return;
+    }
+    // empty: ask for an ENTER after the next batch, then recheck so a
+    // submission that raced with setting the flag is not left sitting there
+    WRITE_ONCE(ring->flags, RING_NEED_WAKEUP);
+    smp_mb();
+    if (READ_ONCE(ring->sq_tail) != head) WRITE_ONCE(ring->flags, 0);
+}
+
+
+// request ETAs: the scheduler replayed on a copy of the car and the queues,
+// counting floor_ms per floor moved and transfer_ms per stop instead of sleeping
+struct eta_sim {
+    pet_slot_t car[MAX_PETS];
+    int car_slots;
+    int pets;
+    int load;
+    int floor;
+    int direction;
+    pet_slot_t *queue[NUM_FLOORS];  // each floor's ring unrolled, oldest first
+    u32 nr_slots[NUM_FLOORS];
+    int waiting[NUM_FLOORS];        // pets in queue
+    struct sched_guard guard;
+    struct xarray *tracked;
+    ktime_t now;
+    u64 t;     // ms replayed so far
+    u32 left;  // pets of estimated requests not delivered yet
+};
+
+// the request a slot belongs to if it gets an estimate. the ring's don't,
+// its producers asked for completions instead
+static struct pet_track *eta_sim_track(struct eta_sim *sim, u32 id) {
+    struct pet_track *track = id ? xa_load(sim->tracked, id) : NULL;
+
+    return track && !track->ring ? track : NULL;
+}
+
+// what the policy sees of the replayed car, as sched_view_elevator
+static void eta_sim_view(struct eta_sim *sim, struct elevator_sched_view *view) {
+    pet_slot_t *queue = sim->queue[sim->floor - 1];
+
+    sched_view_init(view, sim->car, sim->car_slots, sim->pets, sim->load, sim->floor, sim->direction, 0);
+    memcpy(view->waiting, sim->waiting, sizeof(view->waiting));
+    if (sim->pets >= MAX_PETS) return;
+    for (u32 i = 0; i < sim->nr_slots[sim->floor - 1] && !view->fits_here; i++) {
+        if (sim->load + pet_weight[queue[i].type] <= MAX_WEIGHT) view->fits_here = 1;
+    }
+}
+
+// same test as the scheduler: someone to drop off here or a stop to load
+static bool eta_sim_needs_stop(struct eta_sim *sim) {
+    struct elevator_sched_view view;
+
+    eta_sim_view(sim, &view);
+    if (view.riding_to[sim->floor - 1]) return true;
+    return view.fits_here && sched_should_stop(&sim->guard, &view);
+}
+
+// unload then load like transfer_worker_run, stamping a request's pickup when
+// its first pet gets on and its delivery when its last one gets off
+static void eta_sim_transfer(struct eta_sim *sim) {
+    pet_slot_t *queue = sim->queue[sim->floor - 1];
+    ktime_t at = ktime_add_ms(sim->now, sim->t);
+    struct elevator_sched_view view;
+    struct pet_track *track;
+    int kept = 0, moved = 0;
+
+    for (int i = 0; i < sim->car_slots; i++) {
+        pet_slot_t *pet = &sim->car[i];
+
+        if (pet->dest + 1 != sim->floor) {
+            sim->car[kept++] = *pet;
+            continue;
+        }
+        sim->pets -= pet->count;
+        sim->load -= pet_weight[pet->type] * pet->count;
+        moved += pet->count;
+        track = eta_sim_track(sim, pet->id);
+        if (track && track->sim_left) {
+            track->sim_left -= pet->count;
+            sim->left -= pet->count;
+            if (!track->sim_left) track->est_delivery = at;
+        }
+    }
+    sim->car_slots = kept;
+
+    kept = 0;
+    eta_sim_view(sim, &view);
+    for (u32 i = 0; i < sim->nr_slots[sim->floor - 1]; i++) {
+        pet_slot_t pet = queue[i];
+        int fit = sched_pets_to_load(&view, &pet);
+
+        if (fit < pet.count) {
+            queue[kept] = pet;
+            queue[kept++].count = pet.count - fit;
+        }
+        if (fit <= 0) continue;
+
+        pet.count = fit;
+        sched_view_board(&view, &pet, fit);
+        sim->car[sim->car_slots++] = pet;
+        sim->pets += fit;
+        sim->load += pet_weight[pet.type] * fit;
+        sim->waiting[sim->floor - 1] -= fit;
+        moved += fit;
+        track = eta_sim_track(sim, pet.id);
+        if (track && !track->sim_boarded) {
+            track->sim_boarded = 1;
+            track->est_pickup = at;
+        }
+    }
+    sim->nr_slots[sim->floor - 1] = kept;
+    sched_stopped(&sim->guard, moved);
+}
+
+// one move as in scheduler_thread_run, returns the floors run, 0 if the car stays put
+static int eta_sim_move(struct eta_sim *sim) {
+    struct elevator_sched_view view;
+    int direction, floors;
+
+    eta_sim_view(sim, &view);
+    direction = sched_next_direction(&sim->guard, &view);
+    if (!direction) return 0;
+
+    floors = sched_run_length(&view, direction);
+    sim->direction = direction;
+    sim->floor += direction * floors;
+    return floors;
+}
+
+// new estimates for every request from issue_request_ext, all from one replay.
+// called with elev->lock held by issue_request_ext for the new request, and by
+// the scheduler when eta_dirty says one came in since. the car is at
+// current_floor and free to decide in t ms. requests the replay doesn't get
+// to the end of are left without one
+static void eta_refresh(elevator_t *elev, u64 t) {
+    struct eta_sim sim;
+    struct pet_track *track;
+    unsigned long id;
+    pet_slot_t *copy = elev->eta_slots;
+    u32 total = 0;
+    int wanted = 0;
+
+    elev->eta_dirty = 0;
+    elev->eta_at = ktime_get();
+    xa_for_each(&elev->tracked, id, track) {
+        if (track->ring) continue;
+        track->est_pickup = 0;
+        track->est_delivery = 0;
+        track->sim_left = 0;
+        track->sim_boarded = 0;
+        wanted++;
+    }
+    for (int i = 0; i < NUM_FLOORS; i++) total += elev->floors[i].nr_slots;
+    if (!wanted || elev->state == OFFLINE || elev->stopping || total > ETA_MAX_SLOTS) return;
+
+    memcpy(sim.car, elev->pets_in_elevator, sizeof(sim.car));
+    sim.car_slots = elev->car_slots;
+    sim.pets = elev->current_pets;
+    sim.load = elev->current_load;
+    sim.floor = elev->current_floor;
+    sim.direction = elev->direction;
+    sim.guard = elev->guard;
+    sim.tracked = &elev->tracked;
+    sim.now = elev->eta_at;
+    sim.t = t;
+    sim.left = 0;
+    for (int i = 0; i < NUM_FLOORS; i++) {
+        sim.queue[i] = copy;
+        sim.nr_slots[i] = elev->floors[i].nr_slots;
+        sim.waiting[i] = elev->floors[i].waiting_count;
+        for (u32 j = 0; j < elev->floors[i].nr_slots; j++) {
+            *copy = *floor_slot(&elev->floors[i], j);
+            track = eta_sim_track(&sim, copy->id);
+            if (track) {
+                track->sim_left += copy->count;
+                sim.left += copy->count;
+            }
+            copy++;
+        }
+    }
+    // all of it riding: picked up already
+    for (int i = 0; i < sim.car_slots; i++) {
+        track = eta_sim_track(&sim, sim.car[i].id);
+        if (!track) continue;
+        if (!track->sim_left) {
+            track->sim_boarded = 1;
+            track->est_pickup = sim.now;
+        }
+        track->sim_left += sim.car[i].count;
+        sim.left += sim.car[i].count;
+    }
+
+    for (int stops = 0, steps = 0, floors; sim.left > 0 && stops < ETA_MAX_STOPS && steps < ETA_MAX_STEPS; steps++) {
+        if (eta_sim_needs_stop(&sim)) {
+            stops++;
+            eta_sim_transfer(&sim);
+            sim.t += transfer_ms;
+        } else if ((floors = eta_sim_move(&sim))) {
+            sim.t += run_ms(floors);
+        } else if (sim.guard.holds) {
+            sim.t += transfer_ms;  // a policy holding the car, the scheduler naps like this too
+        } else {
+            break;
+        }
+    }
+
+    xa_for_each(&elev->tracked, id, track) {
+        if (track->ring) continue;
+        if (track->sim_left || !track->est_delivery) {
+            track->est_pickup = 0;
+            track->est_delivery = 0;
+        } else if (!track->has_eta) {
+            track->has_eta = 1;
+            track->eta_pickup = track->est_pickup;
+            track->eta_delivery = track->est_delivery;
+        }
+    }
+}
+
+// ms until the car is free to decide: the rest of a run (current_floor is
+// already where it ends) or a whole dwell for a stop in progress
+static u64 eta_busy_ms(elevator_t *elev) {
+    s64 left = 0;
+
+    if (elev->run_from)
+        left = run_ms(abs(elev->current_floor - elev->run_from)) - ktime_ms_delta(ktime_get(), elev->run_start);
+    else if (elev->state == LOADING)
+        left = transfer_ms;
+    return max_t(s64, left, 0);
+}
+
+// ms from now until an estimate, ELEVATOR_ETA_UNKNOWN without one
+static u32 eta_ms(ktime_t est, ktime_t now) {
+    if (!est) return ELEVATOR_ETA_UNKNOWN;
+    return clamp_t(s64, ktime_ms_delta(est, now), 0, U32_MAX - 1);
+}
+
+//do all the start, request, stop handlers
+// start the threads, keep_position leaves floor and direction alone (warm restart)
+static int elevator_start(elevator_t *elev, int keep_position)
+{
+    struct task_struct *old_scheduler, *old_worker;
+    struct task_struct *scheduler, *worker;
+
+    if (mutex_lock_interruptible(&elev->lock)) return -ERESTARTSYS; //added error handling
+
+    if (elev->state != OFFLINE) { // Already running
+        mutex_unlock(&elev->lock);
+        return 1;
+    }
+
+    // the threads from the last run exit on their own after a stop, reap them outside the lock
+    old_scheduler = elev->scheduler_thread;
+    old_worker = elev->transfer_worker;
+    elev->scheduler_thread = NULL;
+    elev->transfer_worker = NULL;
+
+    elev->state = IDLE;
+    elev->loading_at = 0;  // a handoff the last run never finished isn't this run's slack
+    elev->idle_at = 0;
+    if (!keep_position) {
+        elev->current_floor = 1;
+        elev->direction = 1; // Start going UP
+    }
+    mutex_unlock(&elev->lock);
+
+    reap_thread(old_scheduler);
+    reap_thread(old_worker);
+    
+    // Start multiple threads, both pointers are set before either runs
+    scheduler = kthread_create(scheduler_thread_run, elev, "elev_scheduler/%u", elev->id);
+    worker = kthread_create(transfer_worker_run, elev, "elev_transfer/%u", elev->id);
+    
+    //whole error handling for threads
+    if (IS_ERR(scheduler) || IS_ERR(worker)) {
+        if (!IS_ERR(scheduler)) kthread_stop(scheduler);
+        if (!IS_ERR(worker)) kthread_stop(worker);
+        mutex_lock(&elev->lock);
+        elev->state = OFFLINE;
+        mutex_unlock(&elev->lock);
+        return -ENOMEM;
+    }
+    get_task_struct(scheduler);
+    get_task_struct(worker);
+
+    mutex_lock(&elev->lock);
+    elev->scheduler_thread = scheduler;
+    elev->transfer_worker = worker;
+    mutex_unlock(&elev->lock);
+
+    wake_up_process(worker);
+    wake_up_process(scheduler);
+    return 0;
+}
+
+static int elevator_issue(elevator_t *elev, int start_floor, int dest_floor, int type)
+{
+    int ret;
+
+    if (check_request(elev, start_floor, dest_floor, type, 1)) return 1;
+
+    if (mutex_lock_interruptible(&elev->lock)) {
+        count_reject(elev, REJECT_INTERRUPTED);
+        return -ERESTARTSYS;
+    }
+
+    // only allocates when the floor's ring has to grow
+    ret = queue_pet(elev, start_floor, dest_floor, type, 1, 0, ktime_get());
+    if (ret) count_reject(elev, REJECT_NOMEM);
+    else traffic_record(elev, start_floor, dest_floor);
+    
+    mutex_unlock(&elev->lock);
+    return ret;
+} //end of issue request handlet
+
+// count identical pets in one call, queued as a single slot. fills in the
+// request id and, while the car is running, when it expects to pick them up
+// and deliver them
+static int elevator_issue_ext(elevator_t *elev, struct elevator_request *req)
+{
+    int count = req->count ?: 1;
+    struct pet_track *track;
+    int ret = 0;
+
+    req->pickup_ms = ELEVATOR_ETA_UNKNOWN;
+    req->delivery_ms = ELEVATOR_ETA_UNKNOWN;
+
+    if (check_request(elev, req->start_floor, req->dest_floor, req->type, count)) return 1;
+
+    if (mutex_lock_interruptible(&elev->lock)) {
+        count_reject(elev, REJECT_INTERRUPTED);
+        return -ERESTARTSYS;
+    }
+
+    track = track_request(elev, req->start_floor, req->dest_floor, req->type, count, &req->id);
+    if (!track || queue_pet(elev, req->start_floor, req->dest_floor, req->type, count, req->id, ktime_get())) {
+        if (track) kfree(xa_erase(&elev->tracked, req->id));
+        count_reject(elev, REJECT_NOMEM);
+        ret = -ENOMEM;
+        goto out;
+    }
+    traffic_record(elev, req->start_floor, req->dest_floor);
+
+    // one bounded replay, which also moves everyone else's estimates for the cut-in
+    eta_refresh(elev, eta_busy_ms(elev));
+    req->pickup_ms = eta_ms(track->est_pickup, elev->eta_at);
+    req->delivery_ms = eta_ms(track->est_delivery, elev->eta_at);
+out:
+    mutex_unlock(&elev->lock);
+    return ret;
+}
+
+// where a request from issue_request_ext stands now, -ENOENT once it has
+// been delivered
+static int elevator_query(elevator_t *elev, struct elevator_request *req)
+{
+    struct pet_track *track;
+
+    if (mutex_lock_interruptible(&elev->lock)) return -ERESTARTSYS;
+
+    track = req->id ? xa_load(&elev->tracked, req->id) : NULL;
+    if (!track) {
+        mutex_unlock(&elev->lock);
+        return -ENOENT;
+    }
+    req->start_floor = track->start_floor;
+    req->dest_floor = track->dest_floor;
+    req->type = track->type;
+    req->count = track->remaining;
+    // stale once the car is stopping, nothing replaced them
+    if (elev->state == OFFLINE || elev->stopping) {
+        req->pickup_ms = ELEVATOR_ETA_UNKNOWN;
+        req->delivery_ms = ELEVATOR_ETA_UNKNOWN;
+    } else {
+        ktime_t now = ktime_get();
+
+        req->pickup_ms = eta_ms(track->est_pickup, now);
+        req->delivery_ms = eta_ms(track->est_delivery, now);
+    }
+
+    mutex_unlock(&elev->lock);
+    return 0;
+}
+
+static int elevator_stop(elevator_t *elev)
+{
+    int stop_requested = 0;
+    
+    if (mutex_lock_interruptible(&elev->lock))
+        return -ERESTARTSYS; 
+
+    if (elev->state == OFFLINE || elev->stopping) {
+        stop_requested = 1;
+    } else {
+        // the scheduler stops loading, empties the car and then goes OFFLINE
+        elev->stopping = 1;
+        
+        // Wake up scheduler so it can check state and exit
+        wake_up_interruptible(&elev->request_wq); 
+        
+        stop_requested = 0;
+    }
+    
+    mutex_unlock(&elev->lock);
+    return stop_requested;
+}
+
+// look up a system and hold it against elevator_destroy, NULL if there is none
+static elevator_t *elevator_get(u32 id)
+{
+    elevator_t *elev;
+
+    rcu_read_lock();
+    elev = xa_load(&elevator_systems, id);
+    if (elev && !atomic_inc_not_zero(&elev->users)) elev = NULL;
+    rcu_read_unlock();
+    return elev;
+}
+
+static void elevator_put(elevator_t *elev)
+{
+    if (atomic_dec_and_test(&elev->users)) wake_up_var(&elev->users);
+}
+
+// the original three calls drive system 0, which lives as long as the
+// module so they skip the lookup
+int start_elevator_handler(void)
+{
+    return elevator_start(elevator_default, 0);
+}
+
+int issue_request_handler(int start_floor, int dest_floor, int type)
+{
+    return elevator_issue(elevator_default, start_floor, dest_floor, type);
+}
+
+int stop_elevator_handler(void)
+{
+    return elevator_stop(elevator_default);
+}
+
+int start_system_handler(unsigned int system)
+{
+    elevator_t *elev = elevator_get(system);
+    int ret;
+
+    if (!elev) return -ENODEV;
+    ret = elevator_start(elev, 0);
+    elevator_put(elev);
+    return ret;
+}
+
+int stop_system_handler(unsigned int system)
+{
+    elevator_t *elev = elevator_get(system);
+    int ret;
+
+    if (!elev) return -ENODEV;
+    ret = elevator_stop(elev);
+    elevator_put(elev);
+    return ret;
+}
+
+int issue_request_ext_handler(struct elevator_request *req)
+{
+    elevator_t *elev = elevator_get(req->system);
+    int ret;
+
+    if (!elev) return -ENODEV;
+    ret = elevator_issue_ext(elev, req);
+    elevator_put(elev);
+    return ret;
+}
+
+int query_request_handler(struct elevator_request *req)
+{
+    elevator_t *elev = elevator_get(req->system);
+    int ret;
+
+    if (!elev) return -ENODEV;
+    ret = elevator_query(elev, req);
+    elevator_put(elev);
+    return ret;
+}
+
+// add kthread implememntation with a thread function and a proc file implementation
+// Part 3f: LOOK Scheduling Algorithm
+
+// --- TRANSFER WORKER THREAD (Role: Execute Loading/Unloading and 1s Delay) ---
+static int transfer_worker_run(void *data)
+{
+    elevator_t *elev = data;
+    ktime_t dwell_start = 0;
+
+    while (!kthread_should_stop()) {
+        set_current_state(TASK_INTERRUPTIBLE); // Sleep until woken
+        // recheck after setting the state so a wakeup sent before we got here isn't lost
+        if (READ_ONCE(elev->state) != LOADING && !kthread_should_stop()) schedule();
+        __set_current_state(TASK_RUNNING);
+
+        if (kthread_should_stop()) break; // Exit if requested
+        
+        if (mutex_lock_interruptible(&elev->lock)) return -ERESTARTSYS; 
+
+        // check if loading 
+        if (elev->state == LOADING) {
+            floor_t *floor = &elev->floors[elev->current_floor - 1];
+            struct elevator_sched_view view;
+            ktime_t now = ktime_get();
+            int kept = 0, moved = 0;
+
+            jitter_record(elev, JITTER_WAKE_WORKER, &elev->loading_at, 0);
+            
+            // Step 1: UNLOAD pets at current floor, compacting the car as we go
+            for (int i = 0; i < elev->car_slots; i++) {
+                pet_slot_t *pet = &elev->pets_in_elevator[i];
+
+                if (pet->dest + 1 == elev->current_floor) {
+                    elev->current_load -= pet_weight[pet->type] * pet->count;
+                    elev->current_pets -= pet->count;
+                    this_cpu_add(elev->stats->unloaded, pet->count);
+                    moved += pet->count;
+                    if (pet->id) complete_tracked(elev, pet->id, pet->count, now);
+                } else {
+                    elev->pets_in_elevator[kept++] = *pet;
+                }
+            }
+            elev->car_slots = kept;
+            
+            // Step 2: LOAD pets at current floor (FIFO with constraints), not once stopping.
+            // a group is split when only part of it fits or the policy takes
+            // part of it, whatever stays behind is packed back toward the head in order
+            kept = 0;
+            sched_view_elevator(elev, &view);
+            for (u32 i = 0; i < floor->nr_slots; i++) {
+                pet_slot_t pet = *floor_slot(floor, i);
+                int weight = pet_weight[pet.type];
+                int fit = 0;
+
+                // Check capacity constraints
+                if (!elev->stopping) fit = sched_pets_to_load(&view, &pet);
+                if (fit < pet.count) {
+                    pet_slot_t *left = floor_slot(floor, kept++);
+
+                    *left = pet;
+                    left->count = pet.count - fit;
+                }
+                if (fit <= 0) continue;
+
+                pet.count = fit;
+                sched_view_board(&view, &pet, fit);
+                moved += fit;
+                elev->pets_in_elevator[elev->car_slots++] = pet;
+                elev->current_pets += fit;
+                elev->current_load += weight * fit;
+                floor->waiting_count -= fit;
+                elev->waiting_by_type[pet.type] -= fit;
+                this_cpu_add(elev->stats->loaded, fit);
+                if (pet.id) pickup_tracked(elev, pet.id, now);
+
+                u64 wait = ktime_to_ns(ktime_sub(now, slot_arrival(floor, &pet)));
+                this_cpu_add(elev->stats->wait_ns, wait * fit);
+                this_cpu_add(elev->stats->mode_wait_ns[elev->traffic.mode], wait * fit);
+                this_cpu_add(elev->stats->mode_loaded[elev->traffic.mode], fit);
+                this_cpu_add(elev->wait_hist->count[wait_hist_bucket(div_u64(wait, NSEC_PER_MSEC))], fit);
+                // read and write on the same cpu, we may be preempted between two this_cpu ops
+                struct elevator_stats *stats = get_cpu_ptr(elev->stats);
+                if (wait > stats->wait_max_ns) stats->wait_max_ns = wait;
+                put_cpu_ptr(elev->stats);
+            }
+            floor->nr_slots = kept;
+            sched_stopped(&elev->guard, moved);
+            elevator_test_check(elev, false);
+            dwell_start = ktime_get();
+        }
+        
+        // unlock mutex and then sleep for 1 second to load or unload
+        mutex_unlock(&elev->lock);
+        elevator_delay(transfer_ms); // 1.0 second delay for transfer 
+        
+        // 3. Reacquire lock to safely update state and wake scheduler
+        if (mutex_lock_interruptible(&elev->lock)) return -ERESTARTSYS;
+        jitter_record(elev, JITTER_DWELL, &dwell_start, (u64)transfer_ms * USEC_PER_MSEC);
+        
+        // Transfer is complete, return control to scheduler
+        elev->state = IDLE; 
+        elev->idle_at = ktime_get();
+        wake_up_interruptible(&elev->request_wq); 
+
+        mutex_unlock(&elev->lock);
+    }
+    return 0;
+}
+
+
+// submissions waiting on the ring, a peek without elev->lock
+static bool ring_pending(elevator_t *elev) {
+    return READ_ONCE(elev->ring_active) &&
+           READ_ONCE(elev->ring->sq_tail) != READ_ONCE(elev->sq_head);
+}
+
+// sleep through an express run of floors from elev->run_from. the lock is only
+// taken when a pet shows up on the way, to end the run at the first floor ahead
+// the car can still stop at. returns the floors actually run
+static int elevator_run(elevator_t *elev, int from, int direction, int floors) {
+    ktime_t start = elev->run_start;
+
+    for (;;) {
+        s64 left = run_ms(floors) - ktime_ms_delta(ktime_get(), start);
+
+        if (left <= 0 || kthread_should_stop()) break;
+        if (wait_event_interruptible_hrtimeout(elev->request_wq,
+                READ_ONCE(elev->run_cut) || ring_pending(elev) || kthread_should_stop(),
+                ms_to_ktime(left)))
+            continue;  // timed out, the top of the loop sees it
+        if (kthread_should_stop() || mutex_lock_interruptible(&elev->lock)) break;
+
+        this_cpu_inc(elev->stats->run_locks);
+        ring_drain_submissions(elev);
+        elev->run_cut = 0;
+        s64 elapsed = ktime_ms_delta(ktime_get(), start);
+        for (int k = 1; k < floors && !elev->stopping; k++) {
+            int floor = from + k * direction;
+
+            if (run_ms(k) <= elapsed) continue;  // already past it
+            if (floor_fits_car(elev, floor)) {
+                floors = k;
+                elev->current_floor = floor;
+                this_cpu_inc(elev->stats->runs_cut);
+                break;
+            }
+        }
+        mutex_unlock(&elev->lock);
+    }
+    return floors;
+}
+
+// move the car floors in direction as one run. called with elev->lock held,
+// returns with it dropped once the car is there. *start and *intended_us time
+// the run for jitter_record once the lock is back
+static void elevator_move(elevator_t *elev, int direction, int floors, ktime_t *start, u64 *intended_us) {
+    int from = elev->current_floor;
+    int load = elev->current_load;
+
+    *start = ktime_get();
+    elev->run_start = *start;
+    elev->direction = direction;
+    elev->state = (direction == 1) ? UP : DOWN;
+    elev->current_floor += direction * floors;
+    elev->run_from = from;
+    mutex_unlock(&elev->lock);
+
+    floors = elevator_run(elev, from, direction, floors); // 2.0 seconds a floor by default
+    *intended_us = run_ms(floors) * USEC_PER_MSEC;
+    this_cpu_add(elev->stats->floors_traveled, floors);
+    this_cpu_add(elev->stats->load_moved, (u64)load * floors);
+    if (floors > 1) {
+        this_cpu_inc(elev->stats->runs);
+        this_cpu_add(elev->stats->passes_saved, floors - 1);
+    }
+}
+
+// --- SCHEDULER THREAD (Role: Movement and State Control) ---
+static int scheduler_thread_run(void *data)
+{
+    elevator_t *elev = data;
+    ktime_t move_start = 0;
+    u64 move_us = 0;
+    int was_idle = 0;
+    
+    while (!kthread_should_stop()) {
+        ktime_t wait_start = ktime_get();
+        
+        // 1. Wait for work: blocks until new work arrives or checks every 1 sec
+        wait_event_interruptible_timeout(elev->request_wq, 
+                                         elev->state != IDLE || elev->current_pets > 0 || are_pets_waiting(elev) ||
+                                         ring_pending(elev) || elev->stopping,
+                                         msecs_to_jiffies(1000));
+        if (was_idle) this_cpu_add(elev->stats->idle_ns, ktime_to_ns(ktime_sub(ktime_get(), wait_start)));
+        was_idle = 0;
+        
+        if (mutex_lock_interruptible(&elev->lock)) return -ERESTARTSYS; 
+        jitter_record(elev, JITTER_MOVE, &move_start, move_us);
+        jitter_record(elev, JITTER_WAKE_SCHED, &elev->idle_at, 0);
+        elev->run_from = 0;
+        elev->run_cut = 0;
+
+        // pick up anything producers left on the submission ring
+        ring_drain_submissions(elev);
+
+	//added this to top
+	if (elev->state == LOADING){
+
+            mutex_unlock(&elev->lock);
+
+            wait_event_interruptible(elev->request_wq, elev->state 
+		!= LOADING || kthread_should_stop());
+            if (mutex_lock_interruptible(&elev->lock)) return -ERESTARTSYS;
+            jitter_record(elev, JITTER_WAKE_SCHED, &elev->idle_at, 0);
+	}
+
+
+        // if elevator is stopping and empty, go OFFLINE and exit thread
+        // (the worker is reaped by the next start or by module exit)
+        if (elev->stopping && elev->current_pets == 0) {
+             elev->state = OFFLINE;
+             elev->stopping = 0;
+             mutex_unlock(&elev->lock);
+             break; 
+        }
+
+        // check if idle
+        if (elev->current_pets == 0 && !are_pets_waiting(elev)) {
+            int park = traffic_park_floor(elev);
+
+            // wait where the next peak request is likely to come from
+            if (park && park != elev->current_floor) {
+                this_cpu_inc(elev->stats->parks);
+                elevator_move(elev, park > elev->current_floor ? 1 : -1, abs(park - elev->current_floor),
+                              &move_start, &move_us);
+                continue;
+            }
+            elev->state = IDLE;
+            was_idle = 1;
+            mutex_unlock(&elev->lock);
+            continue; // Go back to wait queue
+        }
+
+        // estimates for whatever came in since the last pass, one replay for all
+        if (elev->eta_dirty) eta_refresh(elev, 0);
+
+        // 2. TRANSFER LOGIC (Loading/Unloading)
+        struct elevator_sched_view view;
+        sched_view_elevator(elev, &view);
+
+        // pets in the car getting off here always stop it, loading is up to the policy
+        int needs_transfer = view.riding_to[elev->current_floor - 1] > 0;
+        if (!needs_transfer && view.fits_here) needs_transfer = sched_should_stop(&elev->guard, &view);
+
+
+        if (needs_transfer) {
+            elev->state = LOADING;
+            elev->loading_at = ktime_get();
+            this_cpu_inc(elev->stats->stops);
+            wake_up_process(elev->transfer_worker); // Signal worker to handle transfer
+
+            mutex_unlock(&elev->lock);
+            continue; // Wait for worker to signal back
+        }
+
+        // Step 4: pick a direction, LOOK unless a policy is attached
+        int direction = sched_next_direction(&elev->guard, &view);
+
+        // Execute Movement: straight through to the next floor with something
+        // to do, the floors in between don't need another pass through here
+        if (direction) {
+            elev->direction = direction;
+            elevator_test_check(elev, true);
+            elevator_move(elev, direction, sched_run_length(&view, direction), &move_start, &move_us);
+            continue;
+        }
+
+        // unlock the mutex if no movement was made
+        mutex_unlock(&elev->lock);
+        elevator_delay(transfer_ms); // Small sleep if logic failed to find immediate movement
+    }
+    return 0;
+}
+
+
+// sum the per cpu counters into total
+static void elevator_stats_read(elevator_t *elev, struct elevator_stats *total) {
+    int cpu;
+
+    memset(total, 0, sizeof(*total));
+    for_each_possible_cpu(cpu) {
+        struct elevator_stats *s = per_cpu_ptr(elev->stats, cpu);
+
+        total->issued += s->issued;
+        for (int r = 0; r < NR_REJECT_REASONS; r++) total->rejected[r] += s->rejected[r];
+        total->loaded += s->loaded;
+        total->unloaded += s->unloaded;
+        total->floors_traveled += s->floors_traveled;
+        total->stops += s->stops;
+        total->idle_ns += s->idle_ns;
+        total->wait_ns += s->wait_ns;
+        total->wait_max_ns = max(total->wait_max_ns, s->wait_max_ns);
+        total->load_moved += s->load_moved;
+        total->runs += s->runs;
+        total->runs_cut += s->runs_cut;
+        total->passes_saved += s->passes_saved;
+        total->run_locks += s->run_locks;
+        total->parks += s->parks;
+        for (int i = 0; i < NR_TRAFFIC_MODES; i++) {
+            total->mode_loaded[i] += s->mode_loaded[i];
+            total->mode_wait_ns[i] += s->mode_wait_ns[i];
+        }
+        total->eta_pickups += s->eta_pickups;
+        total->eta_pickup_err_ns += s->eta_pickup_err_ns;
+        total->eta_pickup_bias_ns += s->eta_pickup_bias_ns;
+        total->eta_deliveries += s->eta_deliveries;
+        total->eta_delivery_err_ns += s->eta_delivery_err_ns;
+        total->eta_delivery_bias_ns += s->eta_delivery_bias_ns;
+    }
+}
+
+// p99 of the per cpu wait histograms summed up, 0 if there's no memory to do it
+static u64 elevator_wait_p99(elevator_t *elev) {
+    struct wait_hist *total = kzalloc(sizeof(*total), GFP_KERNEL);
+    u64 p99;
+    int cpu;
+
+    if (!total) return 0;
+    for_each_possible_cpu(cpu) {
+        struct wait_hist *h = per_cpu_ptr(elev->wait_hist, cpu);
+
+        for (int b = 0; b < WAIT_HIST_BUCKETS; b++) total->count[b] += h->count[b];
+    }
+    p99 = wait_hist_percentile(total, 99);
+    kfree(total);
+    return p99;
+}
+
+// /proc/elevator as a seq_file iterator: a record for the car, one per floor
+// from the top down, then the totals. the lock is only held while one record
+// is formatted, so a reader working through thousands of queued pets never
+// holds up the car for long. each record is consistent, the listing as a
+// whole is no longer one snapshot
+#define PROC_REC_CAR 0
+#define PROC_REC_TOTALS (NUM_FLOORS + 1)
+
+static void elevator_show_car(struct seq_file *m, elevator_t *elev) {
+    pet_slot_t *pet;
+
+    seq_printf(m, "Elevator state: %s\n", elevator_state_name(elev->state));
+    seq_printf(m, "Current floor: %d\n", elev->current_floor);
+    seq_printf(m, "Current load: %d lbs\n", elev->current_load);
+    
+    seq_printf(m, "Elevator status:");
+    for (int i = 0; i < elev->car_slots; i++) {
+        pet = &elev->pets_in_elevator[i];
+        seq_printf(m, " %c%d", get_pet_char(pet->type), pet->dest + 1);
+        if (pet->count > 1) seq_printf(m, "x%d", pet->count);
+    }
+    seq_printf(m, "\n\n");
+}
+
+static void elevator_show_floor(struct seq_file *m, elevator_t *elev, int i) {
+    floor_t *floor = &elev->floors[i];
+
+    seq_printf(m, "[%c] Floor %d: %d ", (elev->current_floor == i + 1) ? '*' : ' ', i + 1, floor->waiting_count);
+    for (u32 j = 0; j < floor->nr_slots; j++) {
+        pet_slot_t *pet = floor_slot(floor, j);
+        // a group prints once with its size, e.g. P4x12
+        if (pet->count > 1) seq_printf(m, "%c%dx%d ", get_pet_char(pet->type), pet->dest + 1, pet->count);
+        else seq_printf(m, "%c%d ", get_pet_char(pet->type), pet->dest + 1);
+    }
+    seq_printf(m, "\n");
+}
+
+// the position is the record number, nothing else to keep between records
+static void *elevator_seq_start(struct seq_file *m, loff_t *pos) {
+    return *pos <= PROC_REC_TOTALS ? pos : NULL;
+}
+
+static void *elevator_seq_next(struct seq_file *m, void *v, loff_t *pos) {
+    ++*pos;
+    return elevator_seq_start(m, pos);
+}
+
+static void elevator_seq_stop(struct seq_file *m, void *v) {
+}
+
+static int elevator_seq_show(struct seq_file *m, void *v) {
+    elevator_t *elev = m->private;
+    loff_t rec = *(loff_t *)v;
+    struct elevator_stats stats;
+    int total_waiting = 0;
+
+    if (mutex_lock_interruptible(&elev->lock)) return -ERESTARTSYS; 
+
+    if (rec == PROC_REC_CAR) {
+        elevator_show_car(m, elev);
+    } else if (rec < PROC_REC_TOTALS) {
+        elevator_show_floor(m, elev, NUM_FLOORS - rec);
+    } else {
+        for (int i = 0; i < NUM_FLOORS; i++) total_waiting += elev->floors[i].waiting_count;
+    }
+    mutex_unlock(&elev->lock); 
+    if (rec < PROC_REC_TOTALS) return 0;
+
+    elevator_stats_read(elev, &stats);
+    seq_printf(m, "\nNumber of pets waiting: %d\n", total_waiting);
+    seq_printf(m, "Number of pets serviced: %llu\n", stats.unloaded);
+    return 0;
+}
+
+static const struct seq_operations elevator_seq_ops = {
+    .start = elevator_seq_start,
+    .next  = elevator_seq_next,
+    .stop  = elevator_seq_stop,
+    .show  = elevator_seq_show,
+};
+
+static int elevator_proc_open(struct inode *inode, struct file *file) {
+    int ret = seq_open(file, &elevator_seq_ops);
+
+    if (!ret) ((struct seq_file *)file->private_data)->private = pde_data(inode);
+    return ret;
+}
+
+static const struct proc_ops elevator_proc_ops = {
+    .proc_open    = elevator_proc_open,
+    .proc_read    = seq_read,
+    .proc_lseek   = seq_lseek,
+    .proc_release = seq_release,
+};
+
+// counts only, for frequent polling: one short lock hold however many pets
+// are queued, and nothing per pet is printed
+static int elevator_summary_show(struct seq_file *m, void *v) {
+    elevator_t *elev = m->private;
+    int waiting[NUM_FLOORS], waiting_by_type[NR_PET_TYPES], riding_by_type[NR_PET_TYPES] = { 0 };
+    int state, current_floor, current_load, current_pets, total_waiting = 0;
+    struct elevator_stats stats;
+
+    if (mutex_lock_interruptible(&elev->lock)) return -ERESTARTSYS; 
+    state = elev->state;
+    current_floor = elev->current_floor;
+    current_load = elev->current_load;
+    current_pets = elev->current_pets;
+    for (int i = 0; i < NUM_FLOORS; i++) waiting[i] = elev->floors[i].waiting_count;
+    memcpy(waiting_by_type, elev->waiting_by_type, sizeof(waiting_by_type));
+    for (int i = 0; i < elev->car_slots; i++) {
+        riding_by_type[elev->pets_in_elevator[i].type] += elev->pets_in_elevator[i].count;
+    }
+    mutex_unlock(&elev->lock);
+
+    elevator_stats_read(elev, &stats);
+    seq_printf(m, "Elevator state: %s\n", elevator_state_name(state));
+    seq_printf(m, "Current floor: %d\n", current_floor);
+    seq_printf(m, "Current load: %d lbs\n", current_load);
+    seq_printf(m, "Pets riding: %d\n", current_pets);
+    seq_printf(m, "Riding by type:");
+    for (int t = 0; t < NR_PET_TYPES; t++) seq_printf(m, " %c %d", get_pet_char(t), riding_by_type[t]);
+    seq_printf(m, "\nWaiting by floor:");
+    for (int i = 0; i < NUM_FLOORS; i++) {
+        seq_printf(m, " %d", waiting[i]);
+        total_waiting += waiting[i];
+    }
+    seq_printf(m, "\nWaiting by type:");
+    for (int t = 0; t < NR_PET_TYPES; t++) seq_printf(m, " %c %d", get_pet_char(t), waiting_by_type[t]);
+    seq_printf(m, "\nNumber of pets waiting: %d\n", total_waiting);
+    seq_printf(m, "Number of pets serviced: %llu\n", stats.unloaded);
+    return 0;
+}
+
+static int elevator_summary_open(struct inode *inode, struct file *file) {
+    return single_open(file, elevator_summary_show, pde_data(inode));
+}
+
+static const struct proc_ops elevator_summary_proc_ops = {
+    .proc_open    = elevator_summary_open,
+    .proc_read    = seq_read,
+    .proc_lseek   = seq_lseek,
+    .proc_release = single_release,
+};
+
+// detected traffic mode, the window behind it, the last switches and the
+// waits under each mode to compare them by
+static int elevator_traffic_show(struct seq_file *m, void *v) {
+    elevator_t *elev = m->private;
+    struct elevator_stats stats;
+    struct traffic tr;
+    ktime_t now = ktime_get();
+
+    if (mutex_lock_interruptible(&elev->lock)) return -ERESTARTSYS; 
+    tr = elev->traffic;
+    mutex_unlock(&elev->lock);
+
+    elevator_stats_read(elev, &stats);
+    seq_printf(m, "Mode: %s for %lld s\n", traffic_mode_name(tr.mode), ktime_ms_delta(now, tr.since) / MSEC_PER_SEC);
+    seq_printf(m, "Window: %u requests, %u%% up from the lobby, %u%% down to it\n", tr.nr,
+               tr.nr ? tr.up * 100 / tr.nr : 0, tr.nr ? tr.down * 100 / tr.nr : 0);
+    if (tr.nr) seq_printf(m, "Busiest floor above the lobby: %d\n", tr.heavy_floor);
+    seq_printf(m, "Idle runs to a waiting floor: %llu\n", stats.parks);
+    for (int i = 0; i < NR_TRAFFIC_MODES; i++) {
+        seq_printf(m, "Mean wait %s: %llu ms (%llu pets)\n", traffic_mode_name(i),
+                   stats.mode_loaded[i] ? div64_u64(stats.mode_wait_ns[i], stats.mode_loaded[i]) / NSEC_PER_MSEC : 0,
+                   stats.mode_loaded[i]);
+    }
+    seq_printf(m, "Mode switches: %u\n", tr.switches);
+    for (u32 i = 0; i < min_t(u32, tr.switches, TRAFFIC_HISTORY); i++) {
+        struct traffic_switch *sw = &tr.history[(tr.switches - 1 - i) % TRAFFIC_HISTORY];
+
+        seq_printf(m, "  %lld s ago: %s -> %s (up %u%%, down %u%%)\n",
+                   ktime_ms_delta(now, sw->when) / MSEC_PER_SEC, traffic_mode_name(sw->from),
+                   traffic_mode_name(sw->to), sw->up_pct, sw->down_pct);
+    }
+    return 0;
+}
+
+static int elevator_traffic_open(struct inode *inode, struct file *file) {
+    return single_open(file, elevator_traffic_show, pde_data(inode));
+}
+
+static const struct proc_ops elevator_traffic_proc_ops = {
+    .proc_open    = elevator_traffic_open,
+    .proc_read    = seq_read,
+    .proc_lseek   = seq_lseek,
+    .proc_release = single_release,
+};
+
+static const char *const jitter_kind_names[NR_JITTER_KINDS] = {
+    [JITTER_MOVE]        = "Floor moves",
+    [JITTER_DWELL]       = "Transfers",
+    [JITTER_WAKE_WORKER] = "Wake transfer worker",
+    [JITTER_WAKE_SCHED]  = "Wake scheduler",
+};
+
+// how late moves, dwells and the handoffs between the two threads ran, per
+// kind: overruns, mean and max lateness and the histogram's non-empty buckets.
+// no lock taken
+static int elevator_timing_show(struct seq_file *m, void *v) {
+    elevator_t *elev = m->private;
+    struct jitter_hist *total = kzalloc(sizeof(*total), GFP_KERNEL);
+    u64 lost_us = 0;
+    int cpu;
+
+    if (!total) return -ENOMEM;
+    for_each_possible_cpu(cpu) {
+        struct jitter_hist *h = per_cpu_ptr(elev->jitter, cpu);
+
+        for (int k = 0; k < NR_JITTER_KINDS; k++) {
+            for (int b = 0; b < JITTER_BUCKETS; b++) total->count[k][b] += h->count[k][b];
+            total->late_us[k] += h->late_us[k];
+            total->max_us[k] = max(total->max_us[k], h->max_us[k]);
+            total->overruns[k] += h->overruns[k];
+        }
+    }
+
+    seq_printf(m, "Overrun: moves and transfers over %d%% late, wakeups over %d us\n",
+               JITTER_OVERRUN_PCT, JITTER_WAKE_OVERRUN_US);
+    for (int k = 0; k < NR_JITTER_KINDS; k++) {
+        u64 n = 0;
+
+        for (int b = 0; b < JITTER_BUCKETS; b++) n += total->count[k][b];
+        seq_printf(m, "%s: %llu timed, %llu overruns, late mean %llu us, max %llu us\n", jitter_kind_names[k],
+                   n, total->overruns[k], n ? div64_u64(total->late_us[k], n) : 0, total->max_us[k]);
+        for (int b = 0; b < JITTER_BUCKETS; b++) {
+            if (!total->count[k][b]) continue;
+            if (b == 0) seq_printf(m, "  0 us: %llu\n", total->count[k][b]);
+            else if (b == JITTER_BUCKETS - 1) seq_printf(m, "  %llu us and up: %llu\n", 1ULL << (b - 1), total->count[k][b]);
+            else seq_printf(m, "  %llu-%llu us: %llu\n", 1ULL << (b - 1), (1ULL << b) - 1, total->count[k][b]);
+        }
+        lost_us += total->late_us[k];
+    }
+    // time the car wasn't moving pets because the host ran late
+    seq_printf(m, "Model time lost: %llu ms\n", div_u64(lost_us, USEC_PER_MSEC));
+    kfree(total);
+    return 0;
+}
+
+static int elevator_timing_open(struct inode *inode, struct file *file) {
+    return single_open(file, elevator_timing_show, pde_data(inode));
+}
+
+static const struct proc_ops elevator_timing_proc_ops = {
+    .proc_open    = elevator_timing_open,
+    .proc_read    = seq_read,
+    .proc_lseek   = seq_lseek,
+    .proc_release = single_release,
+};
+
+// counters only, no lock taken
+static int elevator_stats_show(struct seq_file *m, void *v) {
+    elevator_t *elev = m->private;
+    struct elevator_sched_ops *ops;
+    struct elevator_stats stats;
+    char sched[ELEVATOR_SCHED_NAME_MAX] = "look";
+
+    elevator_stats_read(elev, &stats);
+    seq_printf(m, "Requests issued: %llu\n", stats.issued);
+    seq_printf(m, "Rejected (bad floor): %llu\n", stats.rejected[REJECT_FLOOR]);
+    seq_printf(m, "Rejected (same floor): %llu\n", stats.rejected[REJECT_SAME_FLOOR]);
+    seq_printf(m, "Rejected (bad type): %llu\n", stats.rejected[REJECT_TYPE]);
+    seq_printf(m, "Rejected (bad count): %llu\n", stats.rejected[REJECT_COUNT]);
+    seq_printf(m, "Rejected (no memory): %llu\n", stats.rejected[REJECT_NOMEM]);
+    seq_printf(m, "Rejected (interrupted): %llu\n", stats.rejected[REJECT_INTERRUPTED]);
+    seq_printf(m, "Pets loaded: %llu\n", stats.loaded);
+    seq_printf(m, "Pets unloaded: %llu\n", stats.unloaded);
+    seq_printf(m, "Floors traveled: %llu\n", stats.floors_traveled);
+    seq_printf(m, "Stops made: %llu\n", stats.stops);
+    seq_printf(m, "Idle time: %llu ms\n", stats.idle_ns / NSEC_PER_MSEC);
+    seq_printf(m, "Mean wait: %llu ms\n", stats.loaded ? div64_u64(stats.wait_ns, stats.loaded) / NSEC_PER_MSEC : 0);
+    seq_printf(m, "Max wait: %llu ms\n", stats.wait_max_ns / NSEC_PER_MSEC);
+    seq_printf(m, "P99 wait: %llu ms\n", elevator_wait_p99(elev));
+    // average share of MAX_WEIGHT on board while moving between floors
+    seq_printf(m, "Car utilization: %llu%%\n",
+               stats.floors_traveled ? div64_u64(stats.load_moved * 100, stats.floors_traveled * MAX_WEIGHT) : 0);
+    // every floor run past used to be a pass through the scheduler loop and a lock
+    seq_printf(m, "Express runs: %llu (%llu cut short)\n", stats.runs, stats.runs_cut);
+    seq_printf(m, "Decision passes saved: %llu\n", stats.passes_saved);
+    seq_printf(m, "Lock acquisitions saved: %lld\n", (s64)(stats.passes_saved - stats.run_locks));
+    // error is actual - estimate, a positive bias means the estimates run early
+    seq_printf(m, "ETA pickup error: mean %llu ms, bias %lld ms (%llu requests)\n",
+               stats.eta_pickups ? div64_u64(stats.eta_pickup_err_ns, stats.eta_pickups) / NSEC_PER_MSEC : 0,
+               stats.eta_pickups ? div64_s64(stats.eta_pickup_bias_ns, stats.eta_pickups) / NSEC_PER_MSEC : 0,
+               stats.eta_pickups);
+    seq_printf(m, "ETA delivery error: mean %llu ms, bias %lld ms (%llu requests)\n",
+               stats.eta_deliveries ? div64_u64(stats.eta_delivery_err_ns, stats.eta_deliveries) / NSEC_PER_MSEC : 0,
+               stats.eta_deliveries ? div64_s64(stats.eta_delivery_bias_ns, stats.eta_deliveries) / NSEC_PER_MSEC : 0,
+               stats.eta_deliveries);
+
+    rcu_read_lock();
+    ops = rcu_dereference(elevator_sched);
+    if (ops) strscpy(sched, ops->name, sizeof(sched));
+    rcu_read_unlock();
+    seq_printf(m, "Scheduler: %s\n", sched);
+    seq_printf(m, "Scheduler fallbacks: %llu\n", READ_ONCE(elev->guard.fallbacks));
+    return 0;
+}
+
+static int elevator_stats_open(struct inode *inode, struct file *file) {
+    return single_open(file, elevator_stats_show, pde_data(inode));
+}
+
+static const struct proc_ops elevator_stats_proc_ops = {
+    .proc_open    = elevator_stats_open,
+    .proc_read    = seq_read,
+    .proc_lseek   = seq_lseek,
+    .proc_release = single_release,
+};
+
+// ring device: one producer at a time maps the rings and rings ENTER when
+// the kernel has set RING_NEED_WAKEUP. each system has its own device, an
+// open one holds the system
+static int elevator_ring_open(struct inode *inode, struct file *file) {
+    // misc_open left our miscdevice here, swap it for the system
+    elevator_t *elev = container_of(file->private_data, elevator_t, ring_dev);
+
+    // destroy sets dying and reads ring_open under the same lock, so either
+    // it sees us open and backs off or we see it and never take a reference
+    mutex_lock(&elev->lock);
+    if (elev->dying || !atomic_inc_not_zero(&elev->users)) {
+        mutex_unlock(&elev->lock);
+        return -ENODEV;
+    }
+    // the reset below must not pull the indexes out from under a mapping,
+    // whatever still keeps one alive
+    if (atomic_read(&elev->ring_maps) || atomic_cmpxchg(&elev->ring_open, 0, 1) != 0) {
+        mutex_unlock(&elev->lock);
+        elevator_put(elev);
+        return -EBUSY;
+    }
+    file->private_data = elev;
+
+    memset(elev->ring, 0, sizeof(*elev->ring));
+    elev->ring->sq_entries = RING_SQ_ENTRIES;
+    elev->ring->cq_entries = RING_CQ_ENTRIES;
+    elev->ring->flags = RING_NEED_WAKEUP;
+    elev->sq_head = 0;
+    elev->ring_active = 1;
+    mutex_unlock(&elev->lock);
+    return 0;
+}
+
+static int elevator_ring_release(struct inode *inode, struct file *file) {
+    elevator_t *elev = file->private_data;
+
+    mutex_lock(&elev->lock);
+    // nobody is left to read completions for pets still in flight
+    untrack_all(elev, true);
+    elev->ring_active = 0;
+    mutex_unlock(&elev->lock);
+    atomic_set(&elev->ring_open, 0);
+    elevator_put(elev);
+    return 0;
+}
+
+static void elevator_ring_vm_open(struct vm_area_struct *vma) {
+    elevator_t *elev = vma->vm_private_data;
+
+    atomic_inc(&elev->ring_maps);
+}
+
+static void elevator_ring_vm_close(struct vm_area_struct *vma) {
+    elevator_t *elev = vma->vm_private_data;
+
+    atomic_dec(&elev->ring_maps);
+}
+
+// count mappings (fork and split vmas included) so open can refuse a reset
+static const struct vm_operations_struct elevator_ring_vm_ops = {
+    .open  = elevator_ring_vm_open,
+    .close = elevator_ring_vm_close,
+};
+
+static int elevator_ring_mmap(struct file *file, struct vm_area_struct *vma) {
+    elevator_t *elev = file->private_data;
+    int ret;
+
+    if (vma->vm_pgoff != 0) return -EINVAL;
+    ret = remap_vmalloc_range(vma, elev->ring, 0);
+    if (ret) return ret;
+    vma->vm_private_data = elev;
+    vma->vm_ops = &elevator_ring_vm_ops;
+    elevator_ring_vm_open(vma);  // not called for the first mapping
+    return 0;
+}
+
+static long elevator_ring_ioctl(struct file *file, unsigned int cmd, unsigned long arg) {
+    elevator_t *elev = file->private_data;
+
+    if (cmd != ELEVATOR_RING_ENTER) return -ENOTTY;
+
+    // a running car's scheduler drains, the producer never waits on it.
+    // a stopped one has no scheduler, so drain here a batch at a time (the
+    // pets queue like issue_request's do while OFFLINE), at most a ring's worth
+    for (int pass = 0; pass < RING_SQ_ENTRIES / RING_DRAIN_BATCH; pass++) {
+        bool more;
+
+        if (mutex_lock_interruptible(&elev->lock)) return -ERESTARTSYS;
+        if (elev->state != OFFLINE) {
+            mutex_unlock(&elev->lock);
+            wake_up_interruptible(&elev->request_wq);
+            return 0;
+        }
+        ring_drain_submissions(elev);
+        more = ring_pending(elev);
+        // a producer still filling the ring: have it enter again
+        if (more && pass + 1 == RING_SQ_ENTRIES / RING_DRAIN_BATCH) WRITE_ONCE(elev->ring->flags, RING_NEED_WAKEUP);
+        mutex_unlock(&elev->lock);
+        if (!more) break;
+        cond_resched();
+    }
+    return 0;
+}
+
+static __poll_t elevator_ring_poll(struct file *file, poll_table *wait) {
+    elevator_t *elev = file->private_data;
+    struct elevator_ring *ring = elev->ring;
+
+    poll_wait(file, &elev->ring_wq, wait);
+    if (smp_load_acquire(&ring->cq_tail) != READ_ONCE(ring->cq_head)) return EPOLLIN | EPOLLRDNORM;
+    return 0;
+}
+
+static const struct file_operations elevator_ring_fops = {
+    .owner          = THIS_MODULE,
+    .open           = elevator_ring_open,
+    .release        = elevator_ring_release,
+    .mmap           = elevator_ring_mmap,
+    .unlocked_ioctl = elevator_ring_ioctl,
+    .poll           = elevator_ring_poll,
+};
+
+// system call handlers, registered with syscalls.c
+static const struct elevator_ops elevator_syscall_ops = {
+    .start_elevator = start_elevator_handler,
+    .issue_request  = issue_request_handler,
+    .issue_request_ext = issue_request_ext_handler,
+    .query_request  = query_request_handler,
+    .stop_elevator  = stop_elevator_handler,
+    .start_system   = start_system_handler,
+    .stop_system    = stop_system_handler,
+};
+
+// free everything in the car and on the floors
+static void free_all_pets(elevator_t *elev)
+{
+    elev->current_pets = 0;
+    elev->car_slots = 0;
+    elev->current_load = 0;
+    for (int i = 0; i < NUM_FLOORS; i++) {
+        kvfree(elev->floors[i].waiting_queue);
+        elev->floors[i].waiting_queue = NULL;
+        elev->floors[i].head = 0;
+        elev->floors[i].nr_slots = 0;
+        elev->floors[i].capacity = 0;
+        elev->floors[i].waiting_count = 0;
+    }
+    memset(elev->waiting_by_type, 0, sizeof(elev->waiting_by_type));
+    untrack_all(elev, false);
+}
+
+static void elevator_stop_threads(elevator_t *elev)
+{
+    reap_thread(elev->scheduler_thread);
+    reap_thread(elev->transfer_worker);
+    elev->scheduler_thread = NULL;
+    elev->transfer_worker = NULL;
+}
+
+static void elevator_free(elevator_t *elev)
+{
+    free_all_pets(elev);
+    kvfree(elev->eta_slots);
+    vfree(elev->ring);
+    free_percpu(elev->jitter);
+    free_percpu(elev->wait_hist);
+    free_percpu(elev->stats);
+    mutex_destroy(&elev->lock);
+    kfree(elev);
+}
+
+// a new system with its threads stopped, /proc/elevators/<id> and its ring
+// device. id < 0 takes the lowest free one. caller holds elevator_systems_lock
+// (or is module init)
+static elevator_t *elevator_create(int id)
+{
+    elevator_t *elev = kzalloc(sizeof(*elev), GFP_KERNEL);
+    char name[12];
+    u32 new_id;
+    int ret = -ENOMEM;
+
+    if (!elev) return ERR_PTR(-ENOMEM);
+
+    // intiailizing mutxes(part3e)
+    mutex_init(&elev->lock); 
+    init_waitqueue_head(&elev->request_wq);
+    init_waitqueue_head(&elev->ring_wq);
+    atomic_set(&elev->ring_open, 0);
+    atomic_set(&elev->ring_maps, 0);
+    atomic_set(&elev->users, 1);
+
+    //initializing the elevator, the floors' rings are allocated when the first pet arrives
+    elev->state = OFFLINE;
+    elev->current_floor = 1;
+    elev->direction = 1;
+    elev->traffic.since = ktime_get();
+    xa_init_flags(&elev->tracked, XA_FLAGS_ALLOC1);
+
+    elev->stats = alloc_percpu(struct elevator_stats);
+    elev->wait_hist = alloc_percpu(struct wait_hist);
+    elev->jitter = alloc_percpu(struct jitter_hist);
+    // rings are mapped into userspace so they come from vmalloc_user
+    elev->ring = vmalloc_user(sizeof(struct elevator_ring));
+    elev->eta_slots = kvmalloc_array(ETA_MAX_SLOTS, sizeof(pet_slot_t), GFP_KERNEL);
+    if (!elev->stats || !elev->wait_hist || !elev->jitter || !elev->ring || !elev->eta_slots) {
+        goto err_free;
+    }
+
+    // reserve the id, lookups see nothing there until the system is ready
+    if (id < 0) ret = xa_alloc(&elevator_systems, &new_id, NULL, XA_LIMIT(0, MAX_SYSTEMS - 1), GFP_KERNEL);
+    else if (id < MAX_SYSTEMS) ret = xa_insert(&elevator_systems, new_id = id, NULL, GFP_KERNEL);
+    else ret = -EINVAL;
+    if (ret) {
+        goto err_free;
+    }
+    elev->id = new_id;
+
+    ret = -ENOMEM;
+    snprintf(name, sizeof(name), "%u", elev->id);
+    elev->proc_dir = proc_mkdir(name, proc_systems);
+    if (!elev->proc_dir) {
+        goto err_id;
+    }
+    if (!proc_create_data("status", 0444, elev->proc_dir, &elevator_proc_ops, elev) ||
+        !proc_create_data("summary", 0444, elev->proc_dir, &elevator_summary_proc_ops, elev) ||
+        !proc_create_data("stats", 0444, elev->proc_dir, &elevator_stats_proc_ops, elev) ||
+        !proc_create_data("traffic", 0444, elev->proc_dir, &elevator_traffic_proc_ops, elev) ||
+        !proc_create_data("timing", 0444, elev->proc_dir, &elevator_timing_proc_ops, elev)) {
+        goto err_proc;
+    }
+
+    // system 0 keeps the name producers already open
+    if (elev->id == 0) snprintf(elev->ring_name, sizeof(elev->ring_name), RING_DEVNAME);
+    else snprintf(elev->ring_name, sizeof(elev->ring_name), RING_DEVNAME "%u", elev->id);
+    elev->ring_dev.minor = MISC_DYNAMIC_MINOR;
+    elev->ring_dev.name = elev->ring_name;
+    elev->ring_dev.fops = &elevator_ring_fops;
+    elev->ring_dev.mode = 0666;
+    ret = misc_register(&elev->ring_dev);
+    if (ret) {
+        goto err_proc;
+    }
+
+    xa_store(&elevator_systems, elev->id, elev, GFP_KERNEL);
+    return elev;
+
+err_proc:
+    proc_remove(elev->proc_dir);
+err_id:
+    xa_erase(&elevator_systems, elev->id);
+err_free:
+    elevator_free(elev);
+    return ERR_PTR(ret);
+}
+
+// tear down a system already taken out of elevator_systems. waits for
+// syscalls still inside it, then drops whatever is queued or riding
+static void elevator_release(elevator_t *elev)
+{
+    misc_deregister(&elev->ring_dev);
+    proc_remove(elev->proc_dir);
+    elevator_put(elev);
+    wait_var_event(&elev->users, !atomic_read(&elev->users));
+    elevator_stop_threads(elev);
+    elevator_free(elev);
+}
+
+// system 0 can't go, nor can one whose ring is open
+static int elevator_destroy(u32 id)
+{
+    elevator_t *elev;
+
+    mutex_lock(&elevator_systems_lock);
+    elev = xa_load(&elevator_systems, id);
+    if (!elev || id == 0) {
+        mutex_unlock(&elevator_systems_lock);
+        return elev ? -EBUSY : -ENOENT;
+    }
+    // an open ring holds the system. past this no open gets in, and
+    // misc_deregister waits out one that is still in misc_open
+    mutex_lock(&elev->lock);
+    if (!atomic_read(&elev->ring_open)) elev->dying = 1;
+    mutex_unlock(&elev->lock);
+    if (!elev->dying) {
+        mutex_unlock(&elevator_systems_lock);
+        return -EBUSY;
+    }
+    xa_erase(&elevator_systems, id);
+
+    // no lookup still has the pointer without holding a reference
+    synchronize_rcu();
+    elevator_release(elev);
+    mutex_unlock(&elevator_systems_lock);
+    return 0;
+}
+
+// warm restart: on unload everything queued or riding is written to a compact
+// buffer that syscalls.c holds on to, the next load picks it back up.
+// a header, then for each system its state and its groups
+#define CKPT_MAGIC 0x454c4556 // "ELEV"
+#define CKPT_VERSION 4
+
+// records follow each other in one buffer, header and system records are
+// padded to 8 bytes so the pets' s64 after them stays aligned
+struct elevator_ckpt_header {
+  u32 magic;
+  u32 version;
+  u32 nr_systems;
+  u32 pad;
+};
+
+struct elevator_ckpt_system {
+  u32 id;
+  u32 nr_groups;
+  u8 running;  // elevator was started, restart the threads after restore
+  u8 stopping;
+  u8 current_floor;
+  s8 direction;
+  u32 pad;
+};
+
+struct elevator_ckpt_pet {
+  s64 arrival;  // ktime, still valid since we never outlive the boot
+  u16 count;
+  u8 type;
+  u8 start_floor;
+  u8 dest_floor;
+  u8 in_car;
+};
+
+static_assert(sizeof(struct elevator_ckpt_header) % sizeof(s64) == 0);
+static_assert(sizeof(struct elevator_ckpt_system) % sizeof(s64) == 0);
+static_assert(sizeof(struct elevator_ckpt_pet) % sizeof(s64) == 0);
+
+static void ckpt_save_pet(struct elevator_ckpt_pet *rec, pet_slot_t *pet, int start_floor, ktime_t arrival, int in_car) {
+    rec->arrival = ktime_to_ns(arrival);
+    rec->count = pet->count;
+    rec->type = pet->type;
+    rec->start_floor = start_floor;
+    rec->dest_floor = pet->dest + 1;
+    rec->in_car = in_car;
+}
+
+static u32 elevator_nr_groups(elevator_t *elev) {
+    u32 nr_groups = elev->car_slots;
+
+    for (int i = 0; i < NUM_FLOORS; i++) nr_groups += elev->floors[i].nr_slots;
+    return nr_groups;
+}
+
+// running also counts a system restored as running that never got restarted
+static bool ckpt_worth_saving(elevator_t *elev) {
+    return elevator_nr_groups(elev) > 0 || elev->state != OFFLINE || elev->restart;
+}
+
+// one system's part of the checkpoint, returns where the next one goes
+static void *ckpt_save_system(elevator_t *elev, struct elevator_ckpt_system *sys) {
+    struct elevator_ckpt_pet *rec = (struct elevator_ckpt_pet *)(sys + 1);
+
+    sys->id = elev->id;
+    sys->nr_groups = elevator_nr_groups(elev);
+    sys->running = elev->state != OFFLINE || elev->restart;
+    sys->stopping = elev->stopping;
+    sys->current_floor = elev->current_floor;
+    sys->direction = elev->direction;
+
+    // keep load order in the car and arrival order on the floors. riding pets
+    // have been picked up already, their arrival doesn't matter any more
+    for (int i = 0; i < elev->car_slots; i++) {
+        ckpt_save_pet(rec++, &elev->pets_in_elevator[i], elev->current_floor, 0, 1);
+    }
+    for (int i = 0; i < NUM_FLOORS; i++) {
+        for (u32 j = 0; j < elev->floors[i].nr_slots; j++) {
+            pet_slot_t *pet = floor_slot(&elev->floors[i], j);
+            ckpt_save_pet(rec++, pet, i + 1, slot_arrival(&elev->floors[i], pet), 0);
+        }
+    }
+    return rec;
+}
+
+// threads are stopped and syscalls unhooked, so nothing else touches the queues
+static void elevator_save_checkpoint(void) {
+    struct elevator_ckpt_header *hdr;
+    elevator_t *elev;
+    unsigned long id;
+    u32 nr_systems = 0, nr_groups = 0;
+    size_t len;
+    void *p;
+
+    xa_for_each(&elevator_systems, id, elev) {
+        if (!ckpt_worth_saving(elev)) continue;
+        nr_systems++;
+        nr_groups += elevator_nr_groups(elev);
+    }
+    if (nr_systems == 0) return;
+
+    len = sizeof(*hdr) + nr_systems * sizeof(struct elevator_ckpt_system) +
+          (size_t)nr_groups * sizeof(struct elevator_ckpt_pet);
+    hdr = kvzalloc(len, GFP_KERNEL);
+    if (!hdr) {
+        printk(KERN_WARNING "elevator: no memory for checkpoint, dropping %u groups\n", nr_groups);
+        return;
+    }
+
+    hdr->magic = CKPT_MAGIC;
+    hdr->version = CKPT_VERSION;
+    hdr->nr_systems = nr_systems;
+    p = hdr + 1;
+    xa_for_each(&elevator_systems, id, elev) {
+        if (ckpt_worth_saving(elev)) p = ckpt_save_system(elev, p);
+    }
+
+    elevator_stash_checkpoint(hdr, len);
+}
+
+// put one system's groups back, the system is new and nothing else runs yet
+static void ckpt_restore_system(elevator_t *elev, struct elevator_ckpt_system *sys) {
+    struct elevator_ckpt_pet *rec = (struct elevator_ckpt_pet *)(sys + 1);
+
+    for (u32 i = 0; i < sys->nr_groups; i++, rec++) {
+        if (rec->start_floor < MIN_FLOOR || rec->start_floor > MAX_FLOOR) continue;
+        if (rec->dest_floor < MIN_FLOOR || rec->dest_floor > MAX_FLOOR) continue;
+        if (rec->type > DA_TYPE || rec->count < 1 || rec->count > MAX_GROUP) continue;
+
+        if (rec->in_car && elev->current_pets + rec->count <= MAX_PETS) {
+            pet_slot_t *pet = &elev->pets_in_elevator[elev->car_slots++];
+
+            pet->id = 0;
+            pet->arrival = 0;
+            pet->type = rec->type;
+            pet->dest = rec->dest_floor - 1;
+            pet->count = rec->count;
+            elev->current_pets += rec->count;
+            elev->current_load += pet_weight[rec->type] * rec->count;
+        } else if (queue_pet(elev, rec->start_floor, rec->dest_floor, rec->type, rec->count, 0, ns_to_ktime(rec->arrival))) {
+            printk(KERN_WARNING "elevator: no memory restoring system %u, dropping %u groups\n",
+                   elev->id, sys->nr_groups - i);
+            break;
+        }
+    }
+
+    elev->current_floor = sys->current_floor;
+    elev->direction = sys->direction < 0 ? -1 : 1;
+    elev->stopping = sys->stopping;
+    elev->restart = sys->running;
+}
+
+// recreate the systems the last module had, system 0 already exists.
+// ones that were running get restart set
+static void elevator_restore_checkpoint(void) {
+    struct elevator_ckpt_header *hdr;
+    struct elevator_ckpt_system *sys;
+    size_t len, left;
+
+    hdr = elevator_take_checkpoint(&len);
+    if (!hdr) return;
+    if (!restore) {
+        printk(KERN_INFO "elevator: restore=0, dropping the last module's checkpoint\n");
+        kvfree(hdr);
+        return;
+    }
+
+    if (len < sizeof(*hdr) || hdr->magic != CKPT_MAGIC || hdr->version != CKPT_VERSION) {
+        printk(KERN_WARNING "elevator: ignoring unrecognized checkpoint\n");
+        kvfree(hdr);
+        return;
+    }
+
+    sys = (struct elevator_ckpt_system *)(hdr + 1);
+    left = len - sizeof(*hdr);
+    for (u32 i = 0; i < hdr->nr_systems; i++) {
+        elevator_t *elev;
+        size_t size;
+
+        if (left < sizeof(*sys)) break;
+        size = sizeof(*sys) + (size_t)sys->nr_groups * sizeof(struct elevator_ckpt_pet);
+        if (left < size || sys->current_floor < MIN_FLOOR || sys->current_floor > MAX_FLOOR) break;
+
+        elev = sys->id == 0 ? elevator_default : elevator_create(sys->id);
+        if (IS_ERR(elev)) printk(KERN_WARNING "elevator: could not recreate system %u\n", sys->id);
+        else ckpt_restore_system(elev, sys);
+
+        left -= size;
+        sys = (struct elevator_ckpt_system *)((char *)sys + size);
+    }
+    if (left) printk(KERN_WARNING "elevator: checkpoint cut short, some systems were dropped\n");
+    kvfree(hdr);
+}
+
+// /proc/elevators/control: one "id state" line per system. writing
+// "create", "create <id>" or "destroy <id>" adds or removes one
+static int elevator_control_show(struct seq_file *m, void *v) {
+    elevator_t *elev;
+    unsigned long id;
+
+    mutex_lock(&elevator_systems_lock);
+    xa_for_each(&elevator_systems, id, elev) {
+        seq_printf(m, "%lu %s\n", id, elevator_state_name(READ_ONCE(elev->state)));
+    }
+    mutex_unlock(&elevator_systems_lock);
+    return 0;
+}
+
+static int elevator_control_open(struct inode *inode, struct file *file) {
+    return single_open(file, elevator_control_show, NULL);
+}
+
+static ssize_t elevator_control_write(struct file *file, const char __user *ubuf, size_t count, loff_t *ppos) {
+    char buf[32];
+    unsigned int id;
+    int ret;
+
+    if (count >= sizeof(buf)) return -EINVAL;
+    if (copy_from_user(buf, ubuf, count)) return -EFAULT;
+    buf[count] = '\0';
+
+    if (sysfs_streq(buf, "create") || sscanf(buf, "create %u", &id) == 1) {
+        elevator_t *elev;
+
+        mutex_lock(&elevator_systems_lock);
+        elev = elevator_create(sysfs_streq(buf, "create") ? -1 : (int)min_t(unsigned int, id, MAX_SYSTEMS));
+        mutex_unlock(&elevator_systems_lock);
+        ret = IS_ERR(elev) ? PTR_ERR(elev) : 0;
+    } else if (sscanf(buf, "destroy %u", &id) == 1) {
+        ret = elevator_destroy(id);
+    } else {
+        ret = -EINVAL;
+    }
+    return ret ? ret : count;
+}
+
+static const struct proc_ops elevator_control_proc_ops = {
+    .proc_open    = elevator_control_open,
+    .proc_read    = seq_read,
+    .proc_write   = elevator_control_write,
+    .proc_lseek   = seq_lseek,
+    .proc_release = single_release,
+};
+
+#ifdef ELEVATOR_BPF_SCHED
+// elevator_sched_ops as a BPF struct_ops type. one program attached at a time,
+// swapped in and out under RCU so a decision in flight finishes on the old one
+static DEFINE_MUTEX(elevator_sched_lock);
+
+static int bpf_elevator_sched_init(struct btf *btf) {
+    return 0;
+}
+
+// the view is passed as a trusted pointer, plain loads only
+static bool bpf_elevator_sched_is_valid_access(int off, int size, enum bpf_access_type type,
+                                               const struct bpf_prog *prog,
+                                               struct bpf_insn_access_aux *info) {
+    return bpf_tracing_btf_ctx_access(off, size, type, prog, info);
+}
+
+static const struct bpf_verifier_ops bpf_elevator_sched_verifier_ops = {
+    .get_func_proto  = bpf_base_func_proto,
+    .is_valid_access = bpf_elevator_sched_is_valid_access,
+};
+
+static int bpf_elevator_sched_init_member(const struct btf_type *t, const struct btf_member *member,
+                                          void *kdata, const void *udata) {
+    const struct elevator_sched_ops *uops = udata;
+    struct elevator_sched_ops *ops = kdata;
+
+    if (__btf_member_bit_offset(t, member) / 8 != offsetof(struct elevator_sched_ops, name)) return 0;
+    if (strscpy(ops->name, uops->name, sizeof(ops->name)) <= 0) return -EINVAL;
+    return 1;
+}
+
+static int bpf_elevator_sched_reg(void *kdata, struct bpf_link *link) {
+    struct elevator_sched_ops *ops = kdata;
+    int ret = 0;
+
+    mutex_lock(&elevator_sched_lock);
+    if (rcu_access_pointer(elevator_sched)) ret = -EBUSY;
+    else rcu_assign_pointer(elevator_sched, ops);
+    mutex_unlock(&elevator_sched_lock);
+
+    if (!ret) printk(KERN_INFO "elevator: scheduling policy %s attached\n", ops->name);
+    return ret;
+}
+
+static void bpf_elevator_sched_unreg(void *kdata, struct bpf_link *link) {
+    struct elevator_sched_ops *ops = kdata;
+
+    mutex_lock(&elevator_sched_lock);
+    if (rcu_access_pointer(elevator_sched) == ops) RCU_INIT_POINTER(elevator_sched, NULL);
+    mutex_unlock(&elevator_sched_lock);
+    synchronize_rcu();
+    printk(KERN_INFO "elevator: scheduling policy %s detached, back to LOOK\n", ops->name);
+}
+
+// bpf_link_update, replace the attached policy without a LOOK gap
+static int bpf_elevator_sched_update(void *kdata, void *old_kdata, struct bpf_link *link) {
+    int ret = 0;
+
+    mutex_lock(&elevator_sched_lock);
+    if (rcu_access_pointer(elevator_sched) != old_kdata) ret = -ENOENT;
+    else rcu_assign_pointer(elevator_sched, (struct elevator_sched_ops *)kdata);
+    mutex_unlock(&elevator_sched_lock);
+
+    if (!ret) synchronize_rcu();
+    return ret;
+}
+
+static int bpf_elevator_sched_validate(void *kdata) {
+    return 0;
+}
+
+// CFI stubs, the prototypes BPF programs are checked against
+static int elevator_sched_next_direction_stub(struct elevator_sched_view *view) {
+    return 0;
+}
+
+static int elevator_sched_should_stop_stub(struct elevator_sched_view *view) {
+    return 0;
+}
+
+static int elevator_sched_pets_to_load_stub(struct elevator_sched_view *view, int type, int dest_floor, int count) {
+    return 0;
+}
+
+static struct elevator_sched_ops elevator_sched_stubs = {
+    .next_direction = elevator_sched_next_direction_stub,
+    .should_stop    = elevator_sched_should_stop_stub,
+    .pets_to_load   = elevator_sched_pets_to_load_stub,
+};
+
+static struct bpf_struct_ops bpf_elevator_sched_ops = {
+    .verifier_ops = &bpf_elevator_sched_verifier_ops,
+    .init         = bpf_elevator_sched_init,
+    .init_member  = bpf_elevator_sched_init_member,
+    .reg          = bpf_elevator_sched_reg,
+    .unreg        = bpf_elevator_sched_unreg,
+    .update       = bpf_elevator_sched_update,
+    .validate     = bpf_elevator_sched_validate,
+    .cfi_stubs    = &elevator_sched_stubs,
+    .name         = "elevator_sched_ops",
+    .owner        = THIS_MODULE,
+};
+
+// the module holds while a policy is attached, the BPF core drops the type
+// with the module's BTF
+static int elevator_sched_register(void) {
+    return register_bpf_struct_ops(&bpf_elevator_sched_ops, elevator_sched_ops);
+}
+#else
+static int elevator_sched_register(void) {
+    return 0;
+}
+#endif
+
+// modukle entry and exit
+static int __init elevator_init(void)
+{
+    elevator_t *elev;
+    unsigned long id;
+    int ret = -ENOMEM;
+
+    proc_systems = proc_mkdir(SYSTEMS_DIRNAME, NULL);
+    if (!proc_systems) {
+        return -ENOMEM;
+    }
+
+    elevator_default = elevator_create(0);
+    if (IS_ERR(elevator_default)) {
+        ret = PTR_ERR(elevator_default);
+        goto err_systems;
+    }
+    // only once system 0 holds its id
+    if (!proc_create(CONTROL_FILENAME, 0644, proc_systems, &elevator_control_proc_ops)) {
+        goto err_default;
+    }
+
+    //create /proc entries, the top level ones show system 0
+    proc_file = proc_create_data(PROC_FILENAME, 0666, NULL, &elevator_proc_ops, elevator_default);
+    if (!proc_file) {
+        goto err_default;
+    }
+    if (!proc_create_data(STATS_FILENAME, 0444, NULL, &elevator_stats_proc_ops, elevator_default)) {
+        goto err_proc;
+    }
+    if (!proc_create_data(SUMMARY_FILENAME, 0444, NULL, &elevator_summary_proc_ops, elevator_default)) {
+        goto err_stats_proc;
+    }
+    if (!proc_create_data(TRAFFIC_FILENAME, 0444, NULL, &elevator_traffic_proc_ops, elevator_default)) {
+        goto err_summary_proc;
+    }
+    if (!proc_create_data(TIMING_FILENAME, 0444, NULL, &elevator_timing_proc_ops, elevator_default)) {
+        goto err_traffic_proc;
+    }
+
+    // pick up whatever the last module left queued, before any new request can land
+    elevator_restore_checkpoint();
+
+    ret = elevator_register_ops(&elevator_syscall_ops);
+    if (ret) {
+        goto err_restore;
+    }
+
+    // LOOK is always there, a kernel without BPF struct_ops just can't swap it out
+    if (elevator_sched_register())
+        printk(KERN_WARNING "elevator: could not register elevator_sched_ops, staying on LOOK\n");
+
+    xa_for_each(&elevator_systems, id, elev) {
+        if (!elev->restart) continue;
+        if (elevator_start(elev, 1))
+            printk(KERN_WARNING "elevator: could not restart system %lu after restore, pets stay queued\n", id);
+        elev->restart = 0;
+    }
+
+  //  printk(KERN_INFO "Elevator module initialized and syscall stubs linked.\n");
+    return 0;
+
+err_restore:
+    // put the backlog back for the next try, still marked running where it was
+    elevator_save_checkpoint();
+    remove_proc_entry(TIMING_FILENAME, NULL);
+err_traffic_proc:
+    remove_proc_entry(TRAFFIC_FILENAME, NULL);
+err_summary_proc:
+    remove_proc_entry(SUMMARY_FILENAME, NULL);
+err_stats_proc:
+    remove_proc_entry(STATS_FILENAME, NULL);
+err_proc:
+    remove_proc_entry(PROC_FILENAME, NULL);
+err_default:
+    xa_for_each(&elevator_systems, id, elev) {
+        xa_erase(&elevator_systems, id);
+        elevator_release(elev);
+    }
+err_systems:
+    proc_remove(proc_systems);
+    return ret;
+}
+
+static void __exit elevator_exit(void)
+{
+    elevator_t *elev;
+    unsigned long id;
+
+    // unhook the syscalls first, this waits for any call still running in the module
+    elevator_unregister_ops(&elevator_syscall_ops);
+    
+    //stop thread part 3c, after the control file is gone so no system comes or goes
+    remove_proc_entry(CONTROL_FILENAME, proc_systems);
+    xa_for_each(&elevator_systems, id, elev) elevator_stop_threads(elev);
+
+    // hand the backlog to the next load instead of dropping it
+    elevator_save_checkpoint();
+
+    // remove /proc entries and the ring devices (the module can't unload while one is open)
+    remove_proc_entry(PROC_FILENAME, NULL);
+    remove_proc_entry(STATS_FILENAME, NULL);
+    remove_proc_entry(SUMMARY_FILENAME, NULL);
+    remove_proc_entry(TRAFFIC_FILENAME, NULL);
+    remove_proc_entry(TIMING_FILENAME, NULL);
+    xa_for_each(&elevator_systems, id, elev) {
+        xa_erase(&elevator_systems, id);
+        elevator_release(elev);
+    }
+    proc_remove(proc_systems);
+}
+
+#ifdef ELEVATOR_KUNIT_TEST
+#include "elevator_test.c"
+#endif
+
 module_init(elevator_init);
 module_exit(elevator_exit);
 MODULE_LICENSE("GPL");
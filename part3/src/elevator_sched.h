@@ -0,0 +1,43 @@
+#ifndef __ELEVATOR_SCHED_H
+#define __ELEVATOR_SCHED_H
+
+#include <linux/types.h>
+
+// Scheduling policy hooks. elevator.ko runs LOOK unless a BPF struct_ops
+// program implementing elevator_sched_ops is attached, see
+// tests/elevator-test/sched_sstf.bpf.c. Shared with BPF programs, so only
+// plain types in here.
+
+#define ELEVATOR_SCHED_FLOORS 5
+#define ELEVATOR_SCHED_NAME_MAX 16
+
+// what a policy gets to decide on, read only. floors are 1-based in the
+// scalar fields and 0-based as array indexes
+struct elevator_sched_view {
+	__s32 current_floor;
+	__s32 direction;	// last move, 1 up or -1 down
+	__s32 current_load;	// lbs
+	__s32 current_pets;
+	__s32 stopping;		// stop_elevator was called, nothing more gets loaded
+	__s32 fits_here;	// a pet waiting on this floor would fit in the car
+	__s32 waiting[ELEVATOR_SCHED_FLOORS];	// pets waiting on each floor
+	__s32 riding_to[ELEVATOR_SCHED_FLOORS];	// pets in the car going to each floor
+};
+
+// every hook is optional, a missing one or an answer that can't be used is
+// replaced by LOOK's. the car always stops for pets getting off, never
+// loads past MAX_PETS/MAX_WEIGHT and won't sit still for long while there is
+// work elsewhere, whatever the policy says
+struct elevator_sched_ops {
+	// 1 to move up a floor, -1 down, 0 to stay put
+	int (*next_direction)(struct elevator_sched_view *view);
+	// nonzero to stop here and load, only asked when fits_here is set and
+	// nobody is getting off
+	int (*should_stop)(struct elevator_sched_view *view);
+	// how many of a waiting group to take, groups are offered oldest first and
+	// the answer is clamped to what fits. view is updated between groups
+	int (*pets_to_load)(struct elevator_sched_view *view, int type, int dest_floor, int count);
+	char name[ELEVATOR_SCHED_NAME_MAX];
+};
+
+#endif
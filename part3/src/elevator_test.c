@@ -0,0 +1,603 @@
+// KUnit suite for the elevator. It is not built on its own: elevator.c includes
+// it when ELEVATOR_KUNIT_TEST is defined so the tests can drive the handlers and
+// look at the queues directly.
+//
+// The model runs TEST_SCALE times faster than real time, so times reported
+// below are converted back to model seconds.
+
+#include <kunit/test.h>
+
+#define TEST_FLOOR_MS 20
+#define TEST_TRANSFER_MS 10
+#define TEST_SCALE (2000 / TEST_FLOOR_MS)
+#define TEST_TIMEOUT_MS 60000
+
+// timer slack allowed on top of the model, msleep and usleep_range run long
+#define TEST_SLACK_PCT 75
+
+// a run slower than this fails, 0 derives the bound from the model (see model_pets_per_hour)
+static unsigned int kunit_min_pets_per_hour;
+module_param(kunit_min_pets_per_hour, uint, 0644);
+MODULE_PARM_DESC(kunit_min_pets_per_hour, "KUnit: fail below this throughput (model time, 0 = from the model)");
+static unsigned int kunit_max_mean_wait_s;
+module_param(kunit_max_mean_wait_s, uint, 0644);
+MODULE_PARM_DESC(kunit_max_mean_wait_s, "KUnit: fail above this mean wait in seconds (model time, 0 = from the model)");
+
+// filled in by elevator_test_check() from the kthreads, checked by the tests.
+// each call holds its own system's lock only, so the counters are atomic
+static struct {
+  atomic_t checks;
+  atomic_t moves;
+  atomic_t overweight;
+  atomic_t overfull;
+  atomic_t bad_load;       // current_load or current_pets don't match the groups in the car
+  atomic_t bad_waiting;    // waiting_by_type doesn't match the groups on the floors
+  atomic_t bad_floor;
+  atomic_t overshoot;      // moved with nothing left in that direction
+  atomic_t early_reverse;  // turned around with requests still ahead
+  atomic_t last_dir;
+} trace;
+
+static unsigned int saved_floor_ms, saved_transfer_ms, saved_cruise_ms;
+
+// any pet in the car or waiting strictly beyond the current floor in dir
+static int requests_toward(elevator_t *elev, int dir) {
+    for (int i = 0; i < elev->car_slots; i++) {
+        if ((elev->pets_in_elevator[i].dest + 1 - elev->current_floor) * dir > 0) return 1;
+    }
+    if (elev->stopping) return 0;
+    for (int i = 0; i < NUM_FLOORS; i++) {
+        if (elev->floors[i].waiting_count > 0 && (i + 1 - elev->current_floor) * dir > 0) return 1;
+    }
+    return 0;
+}
+
+static void elevator_test_check(elevator_t *elev, bool moving) {
+    int load = 0, pets = 0, by_type[NR_PET_TYPES] = { 0 };
+    int last_dir;
+
+    atomic_inc(&trace.checks);
+    if (elev->current_load > MAX_WEIGHT) atomic_inc(&trace.overweight);
+    if (elev->current_pets > MAX_PETS) atomic_inc(&trace.overfull);
+    for (int i = 0; i < elev->car_slots && i < MAX_PETS; i++) {
+        pet_slot_t *pet = &elev->pets_in_elevator[i];
+
+        load += pet_weight[pet->type] * pet->count;
+        pets += pet->count;
+    }
+    if (load != elev->current_load || pets != elev->current_pets) atomic_inc(&trace.bad_load);
+    for (int i = 0; i < NUM_FLOORS; i++) {
+        for (u32 j = 0; j < elev->floors[i].nr_slots; j++) {
+            pet_slot_t *pet = floor_slot(&elev->floors[i], j);
+            by_type[pet->type] += pet->count;
+        }
+    }
+    if (memcmp(by_type, elev->waiting_by_type, sizeof(by_type))) atomic_inc(&trace.bad_waiting);
+    if (elev->current_floor < MIN_FLOOR || elev->current_floor > MAX_FLOOR) atomic_inc(&trace.bad_floor);
+    // last_dir is one car's, the default one the cases drive
+    if (!moving || elev != elevator_default) return;
+
+    // LOOK: only move toward a request, only turn around once there are none ahead
+    atomic_inc(&trace.moves);
+    if (!requests_toward(elev, elev->direction)) atomic_inc(&trace.overshoot);
+    last_dir = atomic_xchg(&trace.last_dir, elev->direction);
+    if (last_dir && last_dir != elev->direction && requests_toward(elev, last_dir))
+        atomic_inc(&trace.early_reverse);
+}
+
+// fixed seed so every run sees the same traffic
+static u32 test_rand(u32 *seed) {
+    *seed = *seed * 1103515245 + 12345;
+    return *seed >> 16;
+}
+
+static void issue_random(struct kunit *test, u32 *seed, int count) {
+    for (int i = 0; i < count; i++) {
+        int start = 1 + test_rand(seed) % NUM_FLOORS;
+        int dest = 1 + test_rand(seed) % (NUM_FLOORS - 1);
+        if (dest >= start) dest++;
+        KUNIT_ASSERT_EQ(test, issue_request_handler(start, dest, test_rand(seed) % 4), 0);
+    }
+}
+
+static int pets_left(elevator_t *elev) {
+    int left;
+
+    mutex_lock(&elev->lock);
+    left = elev->current_pets;
+    for (int i = 0; i < NUM_FLOORS; i++) left += elev->floors[i].waiting_count;
+    mutex_unlock(&elev->lock);
+    return left;
+}
+
+static void wait_until_delivered(struct kunit *test, elevator_t *elev) {
+    unsigned long deadline = jiffies + msecs_to_jiffies(TEST_TIMEOUT_MS);
+
+    while (pets_left(elev) > 0) {
+        KUNIT_ASSERT_TRUE_MSG(test, time_before(jiffies, deadline),
+                              "%d pets still queued after %d ms", pets_left(elev), TEST_TIMEOUT_MS);
+        msleep(20);
+    }
+}
+
+static void stop_and_wait_offline(struct kunit *test, elevator_t *elev) {
+    unsigned long deadline = jiffies + msecs_to_jiffies(TEST_TIMEOUT_MS);
+
+    KUNIT_ASSERT_EQ(test, elevator_stop(elev), 0);
+    while (READ_ONCE(elev->state) != OFFLINE) {
+        KUNIT_ASSERT_TRUE_MSG(test, time_before(jiffies, deadline), "elevator never went OFFLINE");
+        msleep(20);
+    }
+}
+
+static void expect_invariants(struct kunit *test) {
+    KUNIT_EXPECT_GT(test, atomic_read(&trace.checks), 0);
+    KUNIT_EXPECT_EQ(test, atomic_read(&trace.overweight), 0);
+    KUNIT_EXPECT_EQ(test, atomic_read(&trace.overfull), 0);
+    KUNIT_EXPECT_EQ(test, atomic_read(&trace.bad_load), 0);
+    KUNIT_EXPECT_EQ(test, atomic_read(&trace.bad_waiting), 0);
+    KUNIT_EXPECT_EQ(test, atomic_read(&trace.bad_floor), 0);
+    KUNIT_EXPECT_EQ(test, atomic_read(&trace.overshoot), 0);
+    KUNIT_EXPECT_EQ(test, atomic_read(&trace.early_reverse), 0);
+}
+
+// model time for one sweep end to end, every floor passed and stopped at
+static u64 model_sweep_ms(void) {
+    return (u64)((NUM_FLOORS - 1) * TEST_FLOOR_MS + NUM_FLOORS * TEST_TRANSFER_MS) * TEST_SCALE;
+}
+
+// throughput the model guarantees while a backlog lasts. the car loads whatever
+// fits, so it leaves an end floor full, at least MAX_WEIGHT / heaviest pet, and
+// all of those ride the same way and are off by the other end
+static u64 model_pets_per_hour(void) {
+    int heaviest = 0;
+
+    for (int i = 0; i < NR_PET_TYPES; i++) heaviest = max(heaviest, pet_weight[i]);
+    return div64_u64((u64)(MAX_WEIGHT / heaviest) * 3600 * MSEC_PER_SEC, model_sweep_ms());
+}
+
+// run count random requests, either all queued up front or trickled in while
+// the car is moving, then check everything arrived and report the numbers
+static void run_traffic(struct kunit *test, int count, int burst) {
+    elevator_t *elev = elevator_default;
+    struct elevator_stats before, after;
+    u32 seed = 4610;
+    ktime_t start;
+    u64 elapsed_ms, delivered, loaded, pets_per_hour, mean_wait_s, max_wait_s;
+    u64 min_pets_per_hour, max_mean_wait_s;
+
+    elevator_stats_read(elev, &before);
+    start = ktime_get();
+
+    if (burst == count) issue_random(test, &seed, count);
+    KUNIT_ASSERT_EQ(test, start_elevator_handler(), 0);
+    for (int issued = burst == count ? count : 0; issued < count; issued += burst) {
+        issue_random(test, &seed, min(burst, count - issued));
+        msleep(TEST_FLOOR_MS * 3);
+    }
+
+    wait_until_delivered(test, elev);
+    elapsed_ms = ktime_ms_delta(ktime_get(), start);
+    stop_and_wait_offline(test, elev);
+    elevator_stats_read(elev, &after);
+
+    delivered = after.unloaded - before.unloaded;
+    loaded = after.loaded - before.loaded;
+    KUNIT_EXPECT_EQ(test, delivered, (u64)count);
+    KUNIT_EXPECT_EQ(test, loaded, (u64)count);
+    expect_invariants(test);
+
+    pets_per_hour = div64_u64(delivered * 3600 * MSEC_PER_SEC, max_t(u64, elapsed_ms * TEST_SCALE, 1));
+    mean_wait_s = div64_u64((after.wait_ns - before.wait_ns) * TEST_SCALE, max_t(u64, loaded, 1) * NSEC_PER_SEC);
+    max_wait_s = div64_u64(after.wait_max_ns * TEST_SCALE, NSEC_PER_SEC);
+    kunit_info(test, "%d pets: %llu pets/hour, mean wait %llu s, max wait %llu s, %d moves\n",
+               count, pets_per_hour, mean_wait_s, max_wait_s, atomic_read(&trace.moves));
+
+    // at that rate the k-th pickup is by k / rate, so the mean wait is at most
+    // half the time to pick everyone up, plus the sweep the first one waits for
+    min_pets_per_hour = kunit_min_pets_per_hour ?: div_u64(model_pets_per_hour() * TEST_SLACK_PCT, 100);
+    max_mean_wait_s = kunit_max_mean_wait_s ?:
+        div64_u64((u64)count * 3600, 2 * min_pets_per_hour) + div_u64(model_sweep_ms(), MSEC_PER_SEC);
+    kunit_info(test, "bounds: at least %llu pets/hour, mean wait at most %llu s\n",
+               min_pets_per_hour, max_mean_wait_s);
+
+    KUNIT_EXPECT_GE(test, pets_per_hour, min_pets_per_hour);
+    KUNIT_EXPECT_LE(test, mean_wait_s, max_mean_wait_s);
+}
+
+static void elevator_test_backlog(struct kunit *test) {
+    run_traffic(test, 200, 200);
+}
+
+static void elevator_test_trickle(struct kunit *test) {
+    run_traffic(test, 200, 5);
+}
+
+// 16 lb dachshunds: never more than three fit under MAX_WEIGHT
+static void elevator_test_heavy(struct kunit *test) {
+    elevator_t *elev = elevator_default;
+    for (int i = 0; i < 12; i++) KUNIT_ASSERT_EQ(test, issue_request_handler(1, NUM_FLOORS, DA_TYPE), 0);
+    KUNIT_ASSERT_EQ(test, start_elevator_handler(), 0);
+    wait_until_delivered(test, elev);
+    stop_and_wait_offline(test, elev);
+    expect_invariants(test);
+}
+
+// phases of kind timed so far, over all cpus
+static u64 jitter_timed(elevator_t *elev, enum jitter_kind kind) {
+    u64 n = 0;
+    int cpu;
+
+    for_each_possible_cpu(cpu) {
+        for (int b = 0; b < JITTER_BUCKETS; b++) n += per_cpu_ptr(elev->jitter, cpu)->count[kind][b];
+    }
+    return n;
+}
+
+// a dozen puppies as one request: one slot on the floor, split three at a
+// time (42 lbs) as the car takes them
+static void elevator_test_group(struct kunit *test) {
+    elevator_t *elev = elevator_default;
+    struct elevator_request req = { .start_floor = 1, .dest_floor = 4, .type = PU_TYPE, .count = 12 };
+    struct elevator_stats before, after;
+    u64 timed[NR_JITTER_KINDS];
+
+    for (int k = 0; k < NR_JITTER_KINDS; k++) timed[k] = jitter_timed(elev, k);
+    elevator_stats_read(elev, &before);
+    KUNIT_ASSERT_EQ(test, issue_request_ext_handler(&req), 0);
+    KUNIT_EXPECT_EQ(test, elev->floors[0].nr_slots, 1U);
+    KUNIT_EXPECT_EQ(test, elev->floors[0].waiting_count, 12);
+
+    KUNIT_ASSERT_EQ(test, start_elevator_handler(), 0);
+    wait_until_delivered(test, elev);
+    stop_and_wait_offline(test, elev);
+    elevator_stats_read(elev, &after);
+
+    KUNIT_EXPECT_EQ(test, after.unloaded - before.unloaded, 12ULL);
+    KUNIT_EXPECT_GE(test, after.stops - before.stops, 8ULL);  // 4 trips, on and off
+    // every stop was a dwell and a handoff each way, every trip a timed move
+    KUNIT_EXPECT_GE(test, jitter_timed(elev, JITTER_DWELL) - timed[JITTER_DWELL], 8ULL);
+    KUNIT_EXPECT_GE(test, jitter_timed(elev, JITTER_WAKE_WORKER) - timed[JITTER_WAKE_WORKER], 8ULL);
+    KUNIT_EXPECT_GE(test, jitter_timed(elev, JITTER_WAKE_SCHED) - timed[JITTER_WAKE_SCHED], 8ULL);
+    KUNIT_EXPECT_GE(test, jitter_timed(elev, JITTER_MOVE) - timed[JITTER_MOVE], 7ULL);
+    expect_invariants(test);
+}
+
+// a lone request on an idle car: the replay has nothing to guess about
+static void elevator_test_eta(struct kunit *test) {
+    elevator_t *elev = elevator_default;
+    struct elevator_request req = { .start_floor = 3, .dest_floor = 5, .type = CH_TYPE };
+    struct elevator_request query = { 0 };
+    struct elevator_stats before, after;
+
+    elevator_stats_read(elev, &before);
+    KUNIT_ASSERT_EQ(test, start_elevator_handler(), 0);
+    KUNIT_ASSERT_EQ(test, issue_request_ext_handler(&req), 0);
+    KUNIT_EXPECT_NE(test, req.id, 0U);
+    // up two floors, load, up two more and drop off
+    KUNIT_EXPECT_EQ(test, req.pickup_ms, 2U * TEST_FLOOR_MS);
+    KUNIT_EXPECT_EQ(test, req.delivery_ms, 4U * TEST_FLOOR_MS + TEST_TRANSFER_MS);
+
+    query.id = req.id;
+    KUNIT_EXPECT_EQ(test, query_request_handler(&query), 0);
+    KUNIT_EXPECT_EQ(test, query.dest_floor, 5);
+    KUNIT_EXPECT_LE(test, query.pickup_ms, req.pickup_ms);
+    KUNIT_EXPECT_LE(test, query.delivery_ms, req.delivery_ms);
+
+    wait_until_delivered(test, elev);
+    KUNIT_EXPECT_EQ(test, query_request_handler(&query), -ENOENT);
+    stop_and_wait_offline(test, elev);
+    elevator_stats_read(elev, &after);
+    KUNIT_EXPECT_EQ(test, after.eta_pickups - before.eta_pickups, 1ULL);
+    KUNIT_EXPECT_EQ(test, after.eta_deliveries - before.eta_deliveries, 1ULL);
+    kunit_info(test, "actual - estimate: pickup %lld us, delivery %lld us (scaled time)\n",
+               (after.eta_pickup_bias_ns - before.eta_pickup_bias_ns) / NSEC_PER_USEC,
+               (after.eta_delivery_bias_ns - before.eta_delivery_bias_ns) / NSEC_PER_USEC);
+
+    // the car is off: still tracked, but nothing to estimate against
+    KUNIT_ASSERT_EQ(test, issue_request_ext_handler(&req), 0);
+    KUNIT_EXPECT_EQ(test, req.pickup_ms, ELEVATOR_ETA_UNKNOWN);
+    KUNIT_EXPECT_EQ(test, req.delivery_ms, ELEVATOR_ETA_UNKNOWN);
+    KUNIT_ASSERT_EQ(test, start_elevator_handler(), 0);
+    wait_until_delivered(test, elev);
+    stop_and_wait_offline(test, elev);
+}
+
+// 1 to 5 is a single run past three empty floors, the estimate and the
+// counters both see it that way
+static void elevator_test_express(struct kunit *test) {
+    elevator_t *elev = elevator_default;
+    struct elevator_request req = { .start_floor = 1, .dest_floor = 5, .type = CH_TYPE };
+    struct elevator_stats before, after;
+
+    cruise_ms = TEST_FLOOR_MS / 4;
+    elevator_stats_read(elev, &before);
+    KUNIT_ASSERT_EQ(test, start_elevator_handler(), 0);
+    KUNIT_ASSERT_EQ(test, issue_request_ext_handler(&req), 0);
+    // load, one floor to get going, three cruising
+    KUNIT_EXPECT_EQ(test, req.pickup_ms, 0U);
+    KUNIT_EXPECT_EQ(test, req.delivery_ms, TEST_TRANSFER_MS + TEST_FLOOR_MS + 3U * (TEST_FLOOR_MS / 4));
+
+    wait_until_delivered(test, elev);
+    stop_and_wait_offline(test, elev);
+    elevator_stats_read(elev, &after);
+    KUNIT_EXPECT_EQ(test, after.floors_traveled - before.floors_traveled, 4ULL);
+    KUNIT_EXPECT_EQ(test, after.runs - before.runs, 1ULL);
+    KUNIT_EXPECT_EQ(test, after.passes_saved - before.passes_saved, 3ULL);
+    expect_invariants(test);
+}
+
+static void record_traffic(elevator_t *elev, int start_floor, int dest_floor, int n) {
+    mutex_lock(&elev->lock);
+    for (int i = 0; i < n; i++) traffic_record(elev, start_floor, dest_floor);
+    mutex_unlock(&elev->lock);
+}
+
+// peaks are picked up from the window, held through the hysteresis band and
+// dropped below it. an idle car in a down peak waits at the busiest floor
+static void elevator_test_traffic(struct kunit *test) {
+    elevator_t *elev = elevator_default;
+    unsigned long deadline;
+
+    memset(&elev->traffic, 0, sizeof(elev->traffic));
+    record_traffic(elev, 1, 4, TRAFFIC_MIN_SAMPLES - 1);
+    KUNIT_EXPECT_EQ(test, elev->traffic.mode, TRAFFIC_BALANCED);  // too few to tell
+    record_traffic(elev, 1, 3, 5);
+    KUNIT_EXPECT_EQ(test, elev->traffic.mode, TRAFFIC_UP_PEAK);
+    record_traffic(elev, 2, 3, 20);  // 20 of 40 up, inside the band
+    KUNIT_EXPECT_EQ(test, elev->traffic.mode, TRAFFIC_UP_PEAK);
+    record_traffic(elev, 3, 2, 15);  // 20 of 55
+    KUNIT_EXPECT_EQ(test, elev->traffic.mode, TRAFFIC_BALANCED);
+    record_traffic(elev, 4, 1, TRAFFIC_WINDOW);
+    KUNIT_EXPECT_EQ(test, elev->traffic.mode, TRAFFIC_DOWN_PEAK);
+    KUNIT_EXPECT_EQ(test, elev->traffic.heavy_floor, 4);
+    KUNIT_EXPECT_EQ(test, elev->traffic.switches, 3U);
+
+    KUNIT_ASSERT_EQ(test, start_elevator_handler(), 0);
+    deadline = jiffies + msecs_to_jiffies(TEST_TIMEOUT_MS);
+    while (READ_ONCE(elev->current_floor) != 4 || READ_ONCE(elev->state) != IDLE) {
+        KUNIT_ASSERT_TRUE_MSG(test, time_before(jiffies, deadline), "idle car never went to floor 4");
+        msleep(20);
+    }
+    stop_and_wait_offline(test, elev);
+    memset(&elev->traffic, 0, sizeof(elev->traffic));
+}
+
+// a policy that gets everything wrong: off the building, never stopping to
+// load, taking more than fits. the car has to deliver anyway on LOOK's answers
+static int bad_next_direction(struct elevator_sched_view *view) {
+    return 3;
+}
+
+static int bad_should_stop(struct elevator_sched_view *view) {
+    return 0;
+}
+
+static int bad_pets_to_load(struct elevator_sched_view *view, int type, int dest_floor, int count) {
+    return MAX_PETS * 100;
+}
+
+static struct elevator_sched_ops bad_sched = {
+    .next_direction = bad_next_direction,
+    .should_stop    = bad_should_stop,
+    .pets_to_load   = bad_pets_to_load,
+    .name           = "kunit_bad",
+};
+
+static void elevator_test_bad_policy(struct kunit *test) {
+    elevator_t *elev = elevator_default;
+    u64 fallbacks = elev->guard.fallbacks;
+    u32 seed = 7;
+
+    rcu_assign_pointer(elevator_sched, &bad_sched);
+    issue_random(test, &seed, 20);
+    KUNIT_ASSERT_EQ(test, start_elevator_handler(), 0);
+    wait_until_delivered(test, elev);
+    stop_and_wait_offline(test, elev);
+
+    KUNIT_EXPECT_GT(test, elev->guard.fallbacks, fallbacks);
+    expect_invariants(test);
+}
+
+static void elevator_test_rejects(struct kunit *test) {
+    elevator_t *elev = elevator_default;
+    struct elevator_request req = { .start_floor = 1, .dest_floor = 2, .type = CH_TYPE, .count = MAX_GROUP + 1 };
+
+    KUNIT_EXPECT_EQ(test, issue_request_handler(0, 2, CH_TYPE), 1);
+    KUNIT_EXPECT_EQ(test, issue_request_handler(1, MAX_FLOOR + 1, CH_TYPE), 1);
+    KUNIT_EXPECT_EQ(test, issue_request_handler(3, 3, CH_TYPE), 1);
+    KUNIT_EXPECT_EQ(test, issue_request_handler(1, 2, DA_TYPE + 1), 1);
+    KUNIT_EXPECT_EQ(test, issue_request_ext_handler(&req), 1);
+    KUNIT_EXPECT_EQ(test, pets_left(elev), 0);
+    KUNIT_EXPECT_EQ(test, stop_elevator_handler(), 1);  // not running
+}
+
+// a second system runs its own car: requests and counters stay out of
+// system 0, and once destroyed its id is gone
+static void elevator_test_systems(struct kunit *test) {
+    struct elevator_request req = { .start_floor = 2, .dest_floor = 5, .type = PH_TYPE, .count = 3 };
+    struct elevator_stats before, after, other;
+    elevator_t *elev = elevator_default, *sys;
+    u32 id;
+
+    elevator_stats_read(elev, &before);
+    mutex_lock(&elevator_systems_lock);
+    sys = elevator_create(-1);
+    mutex_unlock(&elevator_systems_lock);
+    KUNIT_ASSERT_FALSE(test, IS_ERR(sys));
+    id = sys->id;
+    KUNIT_EXPECT_NE(test, id, 0U);
+
+    req.system = id;
+    KUNIT_ASSERT_EQ(test, issue_request_ext_handler(&req), 0);
+    KUNIT_EXPECT_EQ(test, pets_left(sys), 3);
+    KUNIT_EXPECT_EQ(test, pets_left(elev), 0);
+
+    KUNIT_ASSERT_EQ(test, start_system_handler(id), 0);
+    KUNIT_EXPECT_EQ(test, READ_ONCE(elev->state), OFFLINE);
+    wait_until_delivered(test, sys);
+    stop_and_wait_offline(test, sys);
+
+    elevator_stats_read(sys, &other);
+    elevator_stats_read(elev, &after);
+    KUNIT_EXPECT_EQ(test, other.unloaded, 3ULL);
+    KUNIT_EXPECT_EQ(test, after.issued - before.issued, 0ULL);
+    expect_invariants(test);
+
+    KUNIT_EXPECT_EQ(test, elevator_destroy(0), -EBUSY);
+    KUNIT_ASSERT_EQ(test, elevator_destroy(id), 0);
+    KUNIT_EXPECT_EQ(test, elevator_destroy(id), -ENOENT);
+    KUNIT_EXPECT_EQ(test, issue_request_ext_handler(&req), -ENODEV);
+    KUNIT_EXPECT_EQ(test, start_system_handler(id), -ENODEV);
+}
+
+// the kmalloc'd list node each waiting pet used to be
+struct list_pet {
+  int type;
+  int weight;
+  int start_floor;
+  int dest_floor;
+  struct list_head list;
+};
+
+#define SCAN_PETS 4096
+#define SCAN_ROUNDS 64
+
+// memory per pet and the cost of a load scan (count the pets that fit and go
+// to a floor) for the old list against a floor ring. standalone data, the
+// elevator isn't touched
+static void elevator_test_storage_scan(struct kunit *test) {
+    floor_t floor = { 0 };
+    LIST_HEAD(queue);
+    struct list_pet *lp, *next;
+    u32 seed = 4610;
+    u64 list_ns, ring_ns, list_bytes = 0;
+    int list_hits = 0, ring_hits = 0;
+    ktime_t t0;
+
+    for (int i = 0; i < SCAN_PETS; i++) {
+        int type = test_rand(&seed) % 4, dest = 1 + test_rand(&seed) % NUM_FLOORS;
+
+        lp = kmalloc(sizeof(*lp), GFP_KERNEL);
+        KUNIT_ASSERT_NOT_NULL(test, lp);
+        lp->type = type;
+        lp->weight = pet_weight[type];
+        lp->dest_floor = dest;
+        list_add_tail(&lp->list, &queue);
+        list_bytes += ksize(lp);
+
+        if (floor.nr_slots == floor.capacity) KUNIT_ASSERT_EQ(test, floor_grow(&floor), 0);
+        pet_slot_t *slot = floor_slot(&floor, floor.nr_slots++);
+        slot->type = type;
+        slot->dest = dest - 1;
+        slot->count = 1;
+    }
+
+    t0 = ktime_get();
+    for (int r = 0; r < SCAN_ROUNDS; r++) {
+        list_for_each_entry(lp, &queue, list) {
+            if (lp->weight <= PH_WEIGHT && lp->dest_floor == 1 + r % NUM_FLOORS) list_hits++;
+        }
+    }
+    list_ns = ktime_to_ns(ktime_sub(ktime_get(), t0));
+
+    t0 = ktime_get();
+    for (int r = 0; r < SCAN_ROUNDS; r++) {
+        for (u32 i = 0; i < floor.nr_slots; i++) {
+            pet_slot_t *slot = floor_slot(&floor, i);
+            if (pet_weight[slot->type] <= PH_WEIGHT && slot->dest == r % NUM_FLOORS) ring_hits++;
+        }
+    }
+    ring_ns = ktime_to_ns(ktime_sub(ktime_get(), t0));
+
+    KUNIT_EXPECT_EQ(test, list_hits, ring_hits);
+    kunit_info(test, "list: %llu bytes/pet, %llu ps/pet scanned\n",
+               div64_u64(list_bytes, SCAN_PETS), div64_u64(list_ns * 1000, SCAN_PETS * SCAN_ROUNDS));
+    kunit_info(test, "ring: %llu bytes/pet, %llu ps/pet scanned\n",
+               div64_u64((u64)floor.capacity * sizeof(pet_slot_t), SCAN_PETS),
+               div64_u64(ring_ns * 1000, SCAN_PETS * SCAN_ROUNDS));
+
+    list_for_each_entry_safe(lp, next, &queue, list) kfree(lp);
+    kvfree(floor.waiting_queue);
+}
+
+// a pet that has waited far longer than 16 bits of ticks still reads back
+// its own arrival. standalone data like storage_scan
+static void elevator_test_long_wait(struct kunit *test) {
+    floor_t floor = { 0 };
+    ktime_t base = ktime_get();
+    ktime_t later = ktime_add_ms(base, 20 * 60 * MSEC_PER_SEC);
+
+    KUNIT_ASSERT_EQ(test, floor_grow(&floor), 0);
+    floor_slot(&floor, 0)->arrival = floor_arrival_ticks(&floor, base);
+    floor.nr_slots = 1;
+    floor_slot(&floor, 1)->arrival = floor_arrival_ticks(&floor, later);
+    floor.nr_slots = 2;
+
+    KUNIT_EXPECT_EQ(test, ktime_ms_delta(slot_arrival(&floor, floor_slot(&floor, 0)), base), 0);
+    KUNIT_EXPECT_EQ(test, ktime_ms_delta(slot_arrival(&floor, floor_slot(&floor, 1)), later), 0);
+    kvfree(floor.waiting_queue);
+}
+
+static int elevator_test_init(struct kunit *test) {
+    elevator_t *elev = elevator_default;
+    saved_floor_ms = floor_ms;
+    saved_transfer_ms = transfer_ms;
+    saved_cruise_ms = cruise_ms;
+    floor_ms = TEST_FLOOR_MS;
+    transfer_ms = TEST_TRANSFER_MS;
+    cruise_ms = 0;
+    memset(&trace, 0, sizeof(trace));
+
+    // max wait is a high water mark, start each case from zero
+    int cpu;
+    for_each_possible_cpu(cpu) per_cpu_ptr(elev->stats, cpu)->wait_max_ns = 0;
+
+    // the suite owns the elevator, it must not be in use
+    KUNIT_ASSERT_EQ(test, READ_ONCE(elev->state), OFFLINE);
+    KUNIT_ASSERT_EQ(test, pets_left(elev), 0);
+    // and LOOK drives it, the ordering checks assume so
+    KUNIT_ASSERT_TRUE(test, !rcu_access_pointer(elevator_sched));
+    // with no traffic from earlier cases, which could put it in a peak mode and park it
+    mutex_lock(&elev->lock);
+    memset(&elev->traffic, 0, sizeof(elev->traffic));
+    elev->traffic.since = ktime_get();
+    mutex_unlock(&elev->lock);
+    return 0;
+}
+
+static void elevator_test_exit(struct kunit *test) {
+    elevator_t *elev = elevator_default;
+    if (READ_ONCE(elev->state) != OFFLINE) elevator_stop(elev);
+    if (rcu_access_pointer(elevator_sched) == &bad_sched) {
+        RCU_INIT_POINTER(elevator_sched, NULL);
+        synchronize_rcu();
+    }
+    floor_ms = saved_floor_ms;
+    transfer_ms = saved_transfer_ms;
+    cruise_ms = saved_cruise_ms;
+}
+
+static struct kunit_case elevator_test_cases[] = {
+    KUNIT_CASE(elevator_test_rejects),
+    KUNIT_CASE(elevator_test_storage_scan),
+    KUNIT_CASE(elevator_test_long_wait),
+    KUNIT_CASE(elevator_test_heavy),
+    KUNIT_CASE(elevator_test_group),
+    KUNIT_CASE(elevator_test_eta),
+    KUNIT_CASE(elevator_test_express),
+    KUNIT_CASE(elevator_test_traffic),
+    KUNIT_CASE(elevator_test_bad_policy),
+    KUNIT_CASE(elevator_test_systems),
+    KUNIT_CASE_SLOW(elevator_test_backlog),
+    KUNIT_CASE_SLOW(elevator_test_trickle),
+    {}
+};
+
+static struct kunit_suite elevator_test_suite = {
+    .name = "elevator",
+    .init = elevator_test_init,
+    .exit = elevator_test_exit,
+    .test_cases = elevator_test_cases,
+};
+kunit_test_suite(elevator_test_suite);
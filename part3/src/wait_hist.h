@@ -0,0 +1,46 @@
+#ifndef __WAIT_HIST_H
+#define __WAIT_HIST_H
+
+#include <linux/types.h>
+
+// wait time histogram both engines keep so their p99 can be compared:
+// 8 buckets per power of two ms (within ~12%), up to about 18 hours
+#define WAIT_HIST_SUB 8
+#define WAIT_HIST_BUCKETS 192
+
+struct wait_hist {
+    u64 count[WAIT_HIST_BUCKETS];
+};
+
+static inline int wait_hist_bucket(u64 ms)
+{
+    int msb;
+
+    if (ms < WAIT_HIST_SUB) return ms;
+    msb = fls64(ms) - 1;
+    return min((msb - 2) * WAIT_HIST_SUB + (int)((ms >> (msb - 3)) & (WAIT_HIST_SUB - 1)), WAIT_HIST_BUCKETS - 1);
+}
+
+// lowest wait in ms that lands in bucket b
+static inline u64 wait_hist_value(int b)
+{
+    if (b < WAIT_HIST_SUB) return b;
+    return (u64)(WAIT_HIST_SUB + b % WAIT_HIST_SUB) << (b / WAIT_HIST_SUB - 1);
+}
+
+// pct of total waits were shorter than this
+static inline u64 wait_hist_percentile(const struct wait_hist *hist, int pct)
+{
+    u64 total = 0, want, seen = 0;
+
+    for (int b = 0; b < WAIT_HIST_BUCKETS; b++) total += hist->count[b];
+    if (total == 0) return 0;
+    want = div_u64(total * pct, 100);
+    for (int b = 0; b < WAIT_HIST_BUCKETS; b++) {
+        seen += hist->count[b];
+        if (seen > want) return wait_hist_value(b);
+    }
+    return wait_hist_value(WAIT_HIST_BUCKETS - 1);
+}
+
+#endif
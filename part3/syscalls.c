@@ -3,45 +3,189 @@
 #include <linux/module.h>
 #include <linux/syscalls.h>
 #include <linux/errno.h>
+#include <linux/mutex.h>
+#include <linux/srcu.h>
+#include <linux/static_call.h>
+#include <linux/slab.h>
+#include "elevator_ops.h"
 
-//call stubs
-int (*STUB_start_elevator)(void) = NULL;
-int (*STUB_issue_request)(int, int, int) = NULL;
-int (*STUB_stop_elevator)(void) = NULL;
+//defaults used while no module is loaded
+static int elevator_nosys_start(void) { return -ENOSYS; }
+static int elevator_nosys_issue(int start_floor, int destination_floor, int type) { return -ENOSYS; }
+static int elevator_nosys_stop(void) { return -ENOSYS; }
+static int elevator_nosys_issue_ext(struct elevator_request *req) { return -ENOSYS; }
+static int elevator_nosys_query(struct elevator_request *req) { return -ENOSYS; }
+static int elevator_nosys_system(unsigned int system) { return -ENOSYS; }
 
-//export symbols
-EXPORT_SYMBOL(STUB_start_elevator);
-EXPORT_SYMBOL(STUB_issue_request);
-EXPORT_SYMBOL(STUB_stop_elevator);
+//call sites are patched to call the module directly (no indirect branch)
+DEFINE_STATIC_CALL(elevator_start, elevator_nosys_start);
+DEFINE_STATIC_CALL(elevator_issue, elevator_nosys_issue);
+DEFINE_STATIC_CALL(elevator_stop, elevator_nosys_stop);
+DEFINE_STATIC_CALL(elevator_issue_ext, elevator_nosys_issue_ext);
+DEFINE_STATIC_CALL(elevator_query, elevator_nosys_query);
+DEFINE_STATIC_CALL(elevator_start_system, elevator_nosys_system);
+DEFINE_STATIC_CALL(elevator_stop_system, elevator_nosys_system);
+
+//every call runs inside an srcu read section so unregister can wait for
+//calls already in flight before the module text goes away
+DEFINE_STATIC_SRCU(elevator_srcu);
+static DEFINE_MUTEX(elevator_ops_lock);
+static const struct elevator_ops *elevator_ops;
+
+//checkpoint left by the last module to unload, kept here since this file is built in
+static void *elevator_checkpoint;
+static size_t elevator_checkpoint_len;
+
+int elevator_register_ops(const struct elevator_ops *ops)
+{
+	mutex_lock(&elevator_ops_lock);
+	if (elevator_ops != NULL) {
+		mutex_unlock(&elevator_ops_lock);
+		return -EBUSY;
+	}
+
+	elevator_ops = ops;
+	static_call_update(elevator_start, ops->start_elevator);
+	static_call_update(elevator_issue, ops->issue_request);
+	static_call_update(elevator_stop, ops->stop_elevator);
+	static_call_update(elevator_issue_ext,
+			   ops->issue_request_ext ? ops->issue_request_ext : elevator_nosys_issue_ext);
+	static_call_update(elevator_query, ops->query_request ? ops->query_request : elevator_nosys_query);
+	static_call_update(elevator_start_system, ops->start_system ? ops->start_system : elevator_nosys_system);
+	static_call_update(elevator_stop_system, ops->stop_system ? ops->stop_system : elevator_nosys_system);
+	mutex_unlock(&elevator_ops_lock);
+	return 0;
+}
+EXPORT_SYMBOL_GPL(elevator_register_ops);
+
+void elevator_unregister_ops(const struct elevator_ops *ops)
+{
+	mutex_lock(&elevator_ops_lock);
+	if (elevator_ops == ops) {
+		static_call_update(elevator_start, elevator_nosys_start);
+		static_call_update(elevator_issue, elevator_nosys_issue);
+		static_call_update(elevator_stop, elevator_nosys_stop);
+		static_call_update(elevator_issue_ext, elevator_nosys_issue_ext);
+		static_call_update(elevator_query, elevator_nosys_query);
+		static_call_update(elevator_start_system, elevator_nosys_system);
+		static_call_update(elevator_stop_system, elevator_nosys_system);
+		elevator_ops = NULL;
+	}
+	mutex_unlock(&elevator_ops_lock);
+
+	//wait out callers that entered before the switch back to the defaults
+	synchronize_srcu(&elevator_srcu);
+}
+EXPORT_SYMBOL_GPL(elevator_unregister_ops);
+
+void elevator_stash_checkpoint(void *buf, size_t len)
+{
+	mutex_lock(&elevator_ops_lock);
+	kvfree(elevator_checkpoint);
+	elevator_checkpoint = buf;
+	elevator_checkpoint_len = len;
+	mutex_unlock(&elevator_ops_lock);
+}
+EXPORT_SYMBOL_GPL(elevator_stash_checkpoint);
+
+void *elevator_take_checkpoint(size_t *len)
+{
+	void *buf;
+
+	mutex_lock(&elevator_ops_lock);
+	buf = elevator_checkpoint;
+	*len = elevator_checkpoint_len;
+	elevator_checkpoint = NULL;
+	elevator_checkpoint_len = 0;
+	mutex_unlock(&elevator_ops_lock);
+	return buf;
+}
+EXPORT_SYMBOL_GPL(elevator_take_checkpoint);
 
 SYSCALL_DEFINE0(start_elevator)
 {
-	//printk(KERN_NOTICE "Inside SYSCALL_DEFINE0 block: %s\n", __FUNCTION__);
+	int idx, ret;
 
-	if (STUB_start_elevator != NULL)
-	{ return STUB_start_elevator(); }
-	else
-	{ return -ENOSYS; }
+	idx = srcu_read_lock(&elevator_srcu);
+	ret = static_call(elevator_start)();
+	srcu_read_unlock(&elevator_srcu, idx);
+	return ret;
 }
 
 SYSCALL_DEFINE3(issue_request, int, start_floor, int, destination_floor, int, type)
 {
-	//printk(KERN_NOTICE "Inside SYSCALL_DEFINE3 block: %s. Request: %d -> %d, Type: %d\n",
-	//	__FUNCTION__, start_floor, destination_floor, type);
+	int idx, ret;
 
-	if (STUB_issue_request != NULL)
-	{ return STUB_issue_request(start_floor, destination_floor, type); }
-	else
-	{ return -ENOSYS; }
+	idx = srcu_read_lock(&elevator_srcu);
+	ret = static_call(elevator_issue)(start_floor, destination_floor, type);
+	srcu_read_unlock(&elevator_srcu, idx);
+	return ret;
 }
 
 SYSCALL_DEFINE0(stop_elevator)
 {
-	//printk(KERN_NOTICE "Inside sysdefin0 " , __FUNCTION__);
+	int idx, ret;
+
+	idx = srcu_read_lock(&elevator_srcu);
+	ret = static_call(elevator_stop)();
+	srcu_read_unlock(&elevator_srcu, idx);
+	return ret;
+}
+
+SYSCALL_DEFINE2(issue_request_ext, struct elevator_request __user *, ureq, size_t, usize)
+{
+	struct elevator_request req;
+	int idx, ret;
+
+	//a smaller struct is zero filled, a bigger one must be zero past what we know
+	ret = copy_struct_from_user(&req, sizeof(req), ureq, usize);
+	if (ret)
+		return ret;
+
+	idx = srcu_read_lock(&elevator_srcu);
+	ret = static_call(elevator_issue_ext)(&req);
+	srcu_read_unlock(&elevator_srcu, idx);
+
+	//hand back the id and estimates, as much as the caller has room for
+	if (ret == 0 && copy_to_user(ureq, &req, min(usize, sizeof(req))))
+		return -EFAULT;
+	return ret;
+}
+
+SYSCALL_DEFINE2(query_request, struct elevator_request __user *, ureq, size_t, usize)
+{
+	struct elevator_request req;
+	int idx, ret;
 
-	if (STUB_stop_elevator != NULL)
-	{ return STUB_stop_elevator(); }
-	else
-	{ return -ENOSYS; }
+	ret = copy_struct_from_user(&req, sizeof(req), ureq, usize);
+	if (ret)
+		return ret;
+
+	idx = srcu_read_lock(&elevator_srcu);
+	ret = static_call(elevator_query)(&req);
+	srcu_read_unlock(&elevator_srcu, idx);
+
+	if (ret == 0 && copy_to_user(ureq, &req, min(usize, sizeof(req))))
+		return -EFAULT;
+	return ret;
+}
+
+SYSCALL_DEFINE1(start_elevator_system, unsigned int, system)
+{
+	int idx, ret;
+
+	idx = srcu_read_lock(&elevator_srcu);
+	ret = static_call(elevator_start_system)(system);
+	srcu_read_unlock(&elevator_srcu, idx);
+	return ret;
+}
+
+SYSCALL_DEFINE1(stop_elevator_system, unsigned int, system)
+{
+	int idx, ret;
 
+	idx = srcu_read_lock(&elevator_srcu);
+	ret = static_call(elevator_stop_system)(system);
+	srcu_read_unlock(&elevator_srcu, idx);
+	return ret;
 }
@@ -0,0 +1,257 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "wrappers.h"
+
+// A/B runs of the elevator engines (elevator.ko, K_part.ko) on the same
+// recorded traffic.
+//
+//   ab record trace.txt num_requests seconds [seed]
+//   ab run trace.txt [-s speedup] engine.ko [engine.ko ...]
+//
+// record writes num_requests random requests spread over seconds of model
+// time, one "offset_ms start dest type" line each. run loads each engine in
+// turn (needs root, no engine may be loaded already), replays the trace,
+// waits for every pet to be delivered and prints the engines side by side.
+// -s runs the model that many times faster (floor_ms/transfer_ms are scaled
+// down and so are the trace offsets), all results are in model time.
+
+#define POLL_MS 20
+#define TIMEOUT_S 3600  // model time, per engine
+
+struct request {
+	long long offset_ms;
+	int start, dest, type;
+};
+
+struct result {
+	char engine[64];	// module name, what rmmod wants
+	long long delivered;
+	double elapsed_s;
+	double pets_per_hour;
+	double mean_wait_s;
+	double p99_wait_s;
+	long long utilization;
+	long long floors;
+};
+
+static long long now_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+static void sleep_ms(long long ms) {
+	if (ms > 0)
+		usleep(ms * 1000);
+}
+
+// value of a "name: number" line in a proc file, -1 if it isn't there
+static long long proc_value(const char *path, const char *name) {
+	FILE *f = fopen(path, "r");
+	char line[256];
+	size_t len = strlen(name);
+	long long v = -1;
+
+	if (!f)
+		return -1;
+	while (fgets(line, sizeof(line), f)) {
+		if (strncmp(line, name, len) == 0 && line[len] == ':') {
+			sscanf(line + len + 1, "%lld", &v);
+			break;
+		}
+	}
+	fclose(f);
+	return v;
+}
+
+static int elevator_offline(void) {
+	FILE *f = fopen("/proc/elevator", "r");
+	char line[256];
+	int offline = 0;
+
+	if (!f)
+		return 1;
+	if (fgets(line, sizeof(line), f))
+		offline = strstr(line, "OFFLINE") != NULL;
+	fclose(f);
+	return offline;
+}
+
+static int cmp_offset(const void *a, const void *b) {
+	const struct request *x = a, *y = b;
+	return (x->offset_ms > y->offset_ms) - (x->offset_ms < y->offset_ms);
+}
+
+static int record(const char *path, int num, int seconds, unsigned int seed) {
+	struct request *reqs = calloc(num, sizeof(*reqs));
+	FILE *f;
+	int i;
+
+	if (!reqs || num <= 0 || seconds <= 0) {
+		printf("need a positive number of requests and seconds\n");
+		return -1;
+	}
+	srand(seed);
+	for (i = 0; i < num; i++) {
+		reqs[i].offset_ms = (long long)rand() % (seconds * 1000LL);
+		reqs[i].start = rand() % 5 + 1;
+		do {
+			reqs[i].dest = rand() % 5 + 1;
+		} while (reqs[i].dest == reqs[i].start);
+		reqs[i].type = rand() % 4;
+	}
+	qsort(reqs, num, sizeof(*reqs), cmp_offset);
+
+	f = fopen(path, "w");
+	if (!f) {
+		perror(path);
+		return -1;
+	}
+	for (i = 0; i < num; i++)
+		fprintf(f, "%lld %d %d %d\n", reqs[i].offset_ms, reqs[i].start, reqs[i].dest, reqs[i].type);
+	fclose(f);
+	free(reqs);
+	printf("wrote %d requests over %d s to %s\n", num, seconds, path);
+	return 0;
+}
+
+static struct request *load_trace(const char *path, int *num) {
+	struct request *reqs = NULL, r;
+	FILE *f = fopen(path, "r");
+	int cap = 0;
+
+	*num = 0;
+	if (!f) {
+		perror(path);
+		return NULL;
+	}
+	while (fscanf(f, "%lld %d %d %d", &r.offset_ms, &r.start, &r.dest, &r.type) == 4) {
+		if (*num == cap) {
+			cap = cap ? cap * 2 : 256;
+			reqs = realloc(reqs, cap * sizeof(*reqs));
+			if (!reqs)
+				break;
+		}
+		reqs[(*num)++] = r;
+	}
+	fclose(f);
+	return reqs;
+}
+
+static int run_engine(const char *ko, struct request *reqs, int num, int speedup, struct result *res) {
+	char cmd[512], *ext;
+	long long start, deadline, unloaded = 0;
+	int i;
+
+	memset(res, 0, sizeof(*res));
+	snprintf(res->engine, sizeof(res->engine), "%s", strrchr(ko, '/') ? strrchr(ko, '/') + 1 : ko);
+	ext = strstr(res->engine, ".ko");
+	if (ext)
+		*ext = '\0';
+
+	if (access("/proc/elevator", F_OK) == 0) {
+		printf("an engine is already loaded, rmmod it first\n");
+		return -1;
+	}
+	// restore=0: a checkpoint left by an earlier elevator.ko would add its
+	// pets to the trace. K_part keeps none and has no such parameter
+	snprintf(cmd, sizeof(cmd), "insmod %s floor_ms=%d transfer_ms=%d%s", ko, 2000 / speedup,
+		 1000 / speedup, strcmp(res->engine, "elevator") == 0 ? " restore=0" : "");
+	if (system(cmd) != 0) {
+		printf("%s failed\n", cmd);
+		return -1;
+	}
+
+	start_elevator();
+	start = now_ms();
+	for (i = 0; i < num; i++) {
+		sleep_ms(start + reqs[i].offset_ms / speedup - now_ms());
+		issue_request(reqs[i].start, reqs[i].dest, reqs[i].type);
+	}
+
+	deadline = start + TIMEOUT_S * 1000LL / speedup;
+	while (now_ms() < deadline) {
+		unloaded = proc_value("/proc/elevator_stats", "Pets unloaded");
+		if (unloaded >= num)
+			break;
+		sleep_ms(POLL_MS);
+	}
+	res->elapsed_s = (now_ms() - start) * speedup / 1000.0;
+	res->delivered = unloaded;
+	if (unloaded < num)
+		printf("%s: only %lld of %d pets delivered after %d s\n", res->engine, unloaded, num, TIMEOUT_S);
+
+	res->pets_per_hour = res->elapsed_s > 0 ? unloaded * 3600.0 / res->elapsed_s : 0;
+	res->mean_wait_s = proc_value("/proc/elevator_stats", "Mean wait") * speedup / 1000.0;
+	res->p99_wait_s = proc_value("/proc/elevator_stats", "P99 wait") * speedup / 1000.0;
+	res->utilization = proc_value("/proc/elevator_stats", "Car utilization");
+	res->floors = proc_value("/proc/elevator_stats", "Floors traveled");
+
+	stop_elevator();
+	while (!elevator_offline())
+		sleep_ms(POLL_MS);
+	snprintf(cmd, sizeof(cmd), "rmmod %s", res->engine);
+	if (system(cmd) != 0) {
+		printf("%s failed\n", cmd);
+		return -1;
+	}
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	struct result *results;
+	struct request *reqs;
+	int speedup = 1, num, i, first, n;
+
+	if (argc >= 5 && strcmp(argv[1], "record") == 0)
+		return record(argv[2], atoi(argv[3]), atoi(argv[4]), argc > 5 ? atoi(argv[5]) : 4610);
+
+	if (argc < 4 || strcmp(argv[1], "run") != 0) {
+		printf("usage: ab record trace.txt num_requests seconds [seed]\n");
+		printf("       ab run trace.txt [-s speedup] engine.ko [engine.ko ...]\n");
+		return -1;
+	}
+	first = 3;
+	if (strcmp(argv[3], "-s") == 0 && argc > 5) {
+		speedup = atoi(argv[4]);
+		first = 5;
+	}
+	if (speedup < 1 || speedup > 1000) {
+		printf("speedup must be between 1 and 1000\n");
+		return -1;
+	}
+
+	reqs = load_trace(argv[2], &num);
+	if (!reqs || num == 0) {
+		printf("no requests in %s\n", argv[2]);
+		return -1;
+	}
+	n = argc - first;
+	results = calloc(n, sizeof(*results));
+	if (!results)
+		return -1;
+
+	for (i = 0; i < n; i++) {
+		printf("running %s on %d requests...\n", argv[first + i], num);
+		fflush(stdout);
+		if (run_engine(argv[first + i], reqs, num, speedup, &results[i]))
+			return -1;
+	}
+
+	printf("\n%-14s %9s %10s %10s %10s %10s %8s %7s\n", "engine", "delivered", "elapsed s", "pets/hour",
+	       "mean wait", "p99 wait", "util %", "floors");
+	for (i = 0; i < n; i++) {
+		struct result *r = &results[i];
+
+		printf("%-14s %9lld %10.0f %10.1f %10.1f %10.1f %8lld %7lld\n", r->engine, r->delivered,
+		       r->elapsed_s, r->pets_per_hour, r->mean_wait_s, r->p99_wait_s, r->utilization, r->floors);
+	}
+
+	free(results);
+	free(reqs);
+	return 0;
+}
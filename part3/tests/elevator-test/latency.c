@@ -0,0 +1,69 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "wrappers.h"
+
+// Times issue_request round trips. By default the request is invalid
+// (floor 0), so the module rejects it before allocating anything and the
+// number is the cost of getting into and out of the handler. --valid
+// issues real requests instead (they queue up in the elevator).
+
+static long long now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int cmp_ll(const void *a, const void *b) {
+	long long x = *(const long long *)a, y = *(const long long *)b;
+	return (x > y) - (x < y);
+}
+
+int main(int argc, char **argv) {
+	int iterations = 1000000;
+	int valid = 0;
+	long long *samples;
+	long long total = 0;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--valid") == 0)
+			valid = 1;
+		else
+			sscanf(argv[i], "%d", &iterations);
+	}
+	if (iterations <= 0) {
+		printf("usage: latency [iterations] [--valid]\n");
+		return -1;
+	}
+
+	samples = malloc(sizeof(*samples) * iterations);
+	if (!samples)
+		return -1;
+
+	// warm up caches and the syscall path
+	for (i = 0; i < 1000; i++)
+		issue_request(0, 1, 0);
+
+	for (i = 0; i < iterations; i++) {
+		long long t0 = now_ns();
+		if (valid)
+			issue_request(1 + i % 5, 1 + (i + 1) % 5, i % 4);
+		else
+			issue_request(0, 1, 0);
+		samples[i] = now_ns() - t0;
+		total += samples[i];
+	}
+
+	qsort(samples, iterations, sizeof(*samples), cmp_ll);
+	printf("issue_request (%s) x %d\n", valid ? "valid" : "rejected", iterations);
+	printf("  mean %lld ns\n", total / iterations);
+	printf("  min  %lld ns\n", samples[0]);
+	printf("  p50  %lld ns\n", samples[iterations / 2]);
+	printf("  p99  %lld ns\n", samples[(long long)iterations * 99 / 100]);
+	printf("  max  %lld ns\n", samples[iterations - 1]);
+
+	free(samples);
+	return 0;
+}
@@ -1,25 +1,113 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
+#include <string.h>
+#include <poll.h>
 #include "wrappers.h"
 
+// give up on the ring after this many seconds without a completion, as
+// happens when the elevator was never started
+#define RING_IDLE_S 10
+
 int rnd(int min, int max) {
 	return rand() % (max - min + 1) + min; //slight bias towards first k
 }
 
+// where each request stands once they are all in, later ones may have cut in
+static void print_estimates(const unsigned int *ids, int num) {
+	struct elevator_request req;
+	int i;
+
+	for (i = 0; i < num; i++) {
+		if (!ids[i])
+			continue;
+		memset(&req, 0, sizeof(req));
+		req.id = ids[i];
+		if (query_request(&req) != 0)
+			printf("Request %u: already delivered\n", ids[i]);
+		else if (req.pickup_ms == ELEVATOR_ETA_UNKNOWN)
+			printf("Request %u: no estimate\n", ids[i]);
+		else
+			printf("Request %u: pickup in %.1f s, delivery in %.1f s\n",
+			       ids[i], req.pickup_ms / 1000.0, req.delivery_ms / 1000.0);
+	}
+}
+
 int main(int argc, char **argv) {
 	int type;
 	int start;
 	int dest;
 	int i;
 	int num;
+	int fd;
+	struct elevator_ring *ring = NULL;
+	int eta = 0;
+	unsigned int *ids = NULL;
 	srand(time(0));
 
-	if (argc != 2) {
-		printf("wrong number of args. producer.x num_of_requests\n");
+	if (argc == 3 && strcmp(argv[2], "--eta") == 0) {
+		eta = 1;
+	} else if (argc == 3 && strcmp(argv[2], "--ring") == 0) {
+		ring = ring_open(&fd);
+		if (!ring) {
+			perror("ring_open");
+			return -1;
+		}
+	} else if (argc != 2) {
+		printf("wrong number of args. producer.x num_of_requests [--ring|--eta]\n");
 		return -1;
 	}
 	sscanf(argv[1],"%d",&num);
+	if (eta) {
+		ids = calloc(num > 0 ? num : 1, sizeof(*ids));
+		if (!ids) {
+			printf("out of memory\n");
+			return -1;
+		}
+	}
+	if (ring) {
+		struct elevator_cqe cqe;
+		struct pollfd pfd = { .fd = fd, .events = POLLIN };
+		int pending = 0, idle = 0;
+
+		// submit everything, then wait for each pet to be accepted and delivered
+		for (i = 0; i < num || pending > 0; ) {
+			while (i < num) {
+				type = rnd(0,3);
+				start = rnd(1, 5);
+				do {
+					dest = rnd(1, 5);
+				} while(dest == start);
+				if (ring_submit(ring, start, dest, type, i) != 0)
+					break;
+				pending++;
+				i++;
+			}
+			ring_enter(ring, fd);
+			if (ring->cq_overflow) {
+				printf("%u completions lost, the ring overflowed\n", ring->cq_overflow);
+				return 1;
+			}
+			if (!ring_reap(ring, &cqe)) {
+				if (poll(&pfd, 1, 1000) == 0 && ++idle >= RING_IDLE_S) {
+					printf("nothing for %d s, giving up with %d pending (is the elevator started?)\n",
+					       RING_IDLE_S, pending);
+					return 1;
+				}
+				continue;
+			}
+			idle = 0;
+			if (cqe.event == RING_EVENT_ACCEPTED) {
+				printf("Request %llu accepted, returned %d\n", cqe.tag, cqe.result);
+				if (cqe.result != 0)
+					pending--;
+			} else {
+				printf("Request %llu delivered\n", cqe.tag);
+				pending--;
+			}
+		}
+		return 0;
+	}
 	for(i=0; i < num;i+=1)
 	{
 		type = rnd(0,3);
@@ -29,8 +117,29 @@ int main(int argc, char **argv) {
 			dest = rnd(1, 6);
 		} while(dest == start);
 
+		if (eta) {
+			struct elevator_request req = { .start_floor = start, .dest_floor = dest, .type = type };
+			long ret = issue_request_eta(&req);
+
+			if (ret != 0) {
+				printf("Issue (%d, %d, %d) returned %ld\n", start, dest, type, ret);
+			} else if (req.pickup_ms == ELEVATOR_ETA_UNKNOWN) {
+				printf("Issue (%d, %d, %d) id %u, no estimate\n", start, dest, type, req.id);
+				ids[i] = req.id;
+			} else {
+				printf("Issue (%d, %d, %d) id %u: pickup in %.1f s, delivery in %.1f s\n",
+				       start, dest, type, req.id, req.pickup_ms / 1000.0, req.delivery_ms / 1000.0);
+				ids[i] = req.id;
+			}
+			continue;
+		}
+
 		long ret = issue_request(start, dest, type);
 		printf("Issue (%d, %d, %d) returned %ld\n", start, dest, type, ret);
 	}
+	if (eta) {
+		print_estimates(ids, num);
+		free(ids);
+	}
 	return 0;
 }
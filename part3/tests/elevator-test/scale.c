@@ -0,0 +1,348 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include "wrappers.h"
+
+// How issue_request scales across cores. For 1, 2, 4... threads, each pinned
+// to its own CPU, every thread calls issue_request as fast as it can for a
+// fixed time. Prints the aggregate rate, how evenly the threads got served
+// and latency percentiles.
+//
+// Like latency, requests are invalid by default, so they are rejected before
+// the elevator lock is taken. --valid sends real requests, which is the path that
+// contends on the lock. Nothing delivers them, so they go to elevator system 1,
+// which is destroyed and created again before each step, and a step ends once
+// any thread has queued its share of -b requests. Every step starts from empty
+// floors and grows them the same way, instead of the later ones paying for a
+// backlog (and floor_grow copies) left by the earlier ones. Needs write access
+// to /proc/elevators/control.
+// --lock-stat clears /proc/lock_stat before each step and prints the
+// line for the elevator lock after it (needs root and CONFIG_LOCK_STAT). Every
+// system's lock shares the one lock_stat class, &elev->lock.
+// --systems sends thread i's valid requests to elevator system i + 1 instead,
+// so no two threads share a lock. Those are reset the same way.
+//
+// usage: scale [-d seconds] [-t max_threads] [-b backlog] [--valid] [--systems] [--lock-stat] [--csv]
+
+// log-linear latency histogram, 16 buckets per power of two (within ~6%)
+#define HIST_SUB 16
+#define HIST_BUCKETS 1024
+
+#define LOCK_CLASS "&elev->lock"
+#define CONTROL "/proc/elevators/control"
+
+// valid requests queued per step across all threads, 12 bytes of floor ring each
+#define BACKLOG_DEFAULT (1 << 20)
+
+// the histogram keeps one thread's ops counter off its neighbour's cache line
+struct worker {
+	pthread_t thread;
+	int cpu;
+	int id;
+	long long ops;
+	long long hist[HIST_BUCKETS];
+};
+
+struct lock_stat {
+	int found;
+	double contentions;
+	double wait_total_us;
+	double wait_max_us;
+	double acquisitions;
+};
+
+static volatile int stop;
+static int valid;
+static int systems;
+static long long share;	// valid requests per thread this step
+static pthread_barrier_t barrier;
+
+static long long now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int hist_bucket(long long ns) {
+	int msb;
+
+	if (ns < HIST_SUB)
+		return ns < 0 ? 0 : ns;
+	msb = 63 - __builtin_clzll(ns);
+	return (msb - 3) * HIST_SUB + ((ns >> (msb - 4)) & (HIST_SUB - 1));
+}
+
+// lowest latency that lands in bucket b
+static long long hist_value(int b) {
+	if (b < HIST_SUB)
+		return b;
+	return (long long)(HIST_SUB + b % HIST_SUB) << (b / HIST_SUB - 1);
+}
+
+static long long hist_percentile(long long *hist, long long total, double p) {
+	long long want = total * p, seen = 0;
+	int b;
+
+	for (b = 0; b < HIST_BUCKETS; b++) {
+		seen += hist[b];
+		if (seen > want)
+			return hist_value(b);
+	}
+	return hist_value(HIST_BUCKETS - 1);
+}
+
+static void *worker_run(void *arg) {
+	struct worker *w = arg;
+	cpu_set_t set;
+	int i = w->id;
+
+	CPU_ZERO(&set);
+	CPU_SET(w->cpu, &set);
+	if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+		fprintf(stderr, "warning: could not pin thread %d to cpu %d\n", w->id, w->cpu);
+
+	// spread valid requests over the floors so threads don't all hit one queue.
+	// the first thread through its share ends the step for everyone, a plain
+	// store so the cap doesn't add a shared counter to what is measured
+	pthread_barrier_wait(&barrier);
+	while (!stop) {
+		long long t0 = now_ns();
+		if (valid)
+			issue_system_request(systems ? 1 + w->id : 1, 1 + i % 5, 1 + (i + 1) % 5, i % 4, 1);
+		else
+			issue_request(0, 1, 0);
+		w->hist[hist_bucket(now_ns() - t0)]++;
+		w->ops++;
+		i++;
+		if (valid && w->ops >= share)
+			stop = 1;
+	}
+	return NULL;
+}
+
+static int control_write(const char *verb, int id) {
+	char buf[32];
+	int fd = open(CONTROL, O_WRONLY), len, ok;
+
+	if (fd < 0)
+		return -1;
+	len = snprintf(buf, sizeof(buf), "%s %d", verb, id);
+	ok = write(fd, buf, len) == len;
+	close(fd);
+	return ok ? 0 : -1;
+}
+
+// fresh systems 1..n with nothing queued, a missing one is fine to destroy
+static int systems_reset(int n) {
+	int id;
+
+	for (id = 1; id <= n; id++) {
+		control_write("destroy", id);
+		if (control_write("create", id) < 0) {
+			perror("create system via " CONTROL);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static void lock_stat_clear(void) {
+	FILE *f = fopen("/proc/lock_stat", "w");
+
+	if (!f) {
+		perror("/proc/lock_stat");
+		return;
+	}
+	fputs("0", f);
+	fclose(f);
+}
+
+// class name: con-bounces contentions waittime-min waittime-max waittime-total
+// waittime-avg acq-bounces acquisitions holdtime-... (times in us)
+static void lock_stat_read(struct lock_stat *ls) {
+	FILE *f = fopen("/proc/lock_stat", "r");
+	char line[1024];
+
+	memset(ls, 0, sizeof(*ls));
+	if (!f)
+		return;
+	while (fgets(line, sizeof(line), f)) {
+		char *p = strstr(line, LOCK_CLASS ":");
+		double v[8];
+
+		if (!p)
+			continue;
+		if (sscanf(p + strlen(LOCK_CLASS ":"), "%lf %lf %lf %lf %lf %lf %lf %lf",
+			   &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7]) == 8) {
+			ls->found = 1;
+			ls->contentions = v[1];
+			ls->wait_max_us = v[3];
+			ls->wait_total_us = v[4];
+			ls->acquisitions = v[7];
+		}
+		break;
+	}
+	fclose(f);
+}
+
+static int run(int threads, int *cpus, int seconds, long long backlog, int lock_stat, int csv) {
+	struct worker *workers = calloc(threads, sizeof(*workers));
+	long long hist[HIST_BUCKETS] = { 0 };
+	long long total = 0, min_ops = -1, max_ops = 0, start, wall;
+	double sum_sq = 0, fairness, rate;
+	struct lock_stat ls = { 0 };
+	int i, b;
+
+	if (!workers) {
+		printf("out of memory\n");
+		return -1;
+	}
+
+	if (valid && systems_reset(systems ? threads : 1) < 0) {
+		free(workers);
+		return -1;
+	}
+	share = backlog / threads > 0 ? backlog / threads : 1;
+	stop = 0;
+	pthread_barrier_init(&barrier, NULL, threads + 1);
+	for (i = 0; i < threads; i++) {
+		workers[i].cpu = cpus[i];
+		workers[i].id = i;
+		pthread_create(&workers[i].thread, NULL, worker_run, &workers[i]);
+	}
+	if (lock_stat)
+		lock_stat_clear();
+	pthread_barrier_wait(&barrier);
+	start = now_ns();
+	sleep(seconds);
+	stop = 1;
+	for (i = 0; i < threads; i++)
+		pthread_join(workers[i].thread, NULL);
+	wall = now_ns() - start;
+	pthread_barrier_destroy(&barrier);
+	if (lock_stat)
+		lock_stat_read(&ls);
+
+	for (i = 0; i < threads; i++) {
+		long long ops = workers[i].ops;
+
+		total += ops;
+		sum_sq += (double)ops * ops;
+		if (min_ops < 0 || ops < min_ops)
+			min_ops = ops;
+		if (ops > max_ops)
+			max_ops = ops;
+		for (b = 0; b < HIST_BUCKETS; b++)
+			hist[b] += workers[i].hist[b];
+	}
+	// Jain's index: 1.0 when every thread got the same share, 1/threads when one got all
+	fairness = sum_sq > 0 ? (double)total * total / (threads * sum_sq) : 0;
+	rate = total * 1e9 / wall;
+
+	if (csv) {
+		printf("%d,%lld,%.0f,%lld,%lld,%.3f,%lld,%lld,%lld,%lld", threads, total, rate, min_ops, max_ops,
+		       fairness, hist_percentile(hist, total, 0.5), hist_percentile(hist, total, 0.9),
+		       hist_percentile(hist, total, 0.99), hist_percentile(hist, total, 0.999));
+		if (lock_stat)
+			printf(",%.0f,%.0f,%.2f,%.2f", ls.contentions, ls.acquisitions,
+			       ls.contentions ? ls.wait_total_us / ls.contentions : 0, ls.wait_max_us);
+		printf("\n");
+	} else {
+		printf("%3d %12lld %12.0f %11lld %11lld %6.3f %8lld %8lld %8lld %8lld", threads, total, rate,
+		       min_ops, max_ops, fairness, hist_percentile(hist, total, 0.5),
+		       hist_percentile(hist, total, 0.9), hist_percentile(hist, total, 0.99),
+		       hist_percentile(hist, total, 0.999));
+		if (lock_stat && ls.found)
+			printf(" %12.0f %12.0f %10.2f %10.2f", ls.contentions, ls.acquisitions,
+			       ls.contentions ? ls.wait_total_us / ls.contentions : 0, ls.wait_max_us);
+		else if (lock_stat)
+			printf("   (no " LOCK_CLASS " in /proc/lock_stat)");
+		printf("\n");
+	}
+	fflush(stdout);
+
+	free(workers);
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	int seconds = 2, max_threads = 0, lock_stat = 0, csv = 0;
+	long long backlog = BACKLOG_DEFAULT;
+	int *cpus, nr_cpus = 0, i, t;
+	cpu_set_t allowed;
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-d") == 0 && i + 1 < argc)
+			seconds = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+			max_threads = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc)
+			backlog = atoll(argv[++i]);
+		else if (strcmp(argv[i], "--valid") == 0)
+			valid = 1;
+		else if (strcmp(argv[i], "--systems") == 0)
+			systems = valid = 1;
+		else if (strcmp(argv[i], "--lock-stat") == 0)
+			lock_stat = 1;
+		else if (strcmp(argv[i], "--csv") == 0)
+			csv = 1;
+		else {
+			printf("usage: %s [-d seconds] [-t max_threads] [-b backlog] [--valid] [--systems] [--lock-stat] "
+			       "[--csv]\n", argv[0]);
+			return -1;
+		}
+	}
+	if (seconds <= 0 || backlog <= 0) {
+		printf("duration and backlog must be positive\n");
+		return -1;
+	}
+
+	// one thread per cpu we are allowed to run on, never two on the same one
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+		perror("sched_getaffinity");
+		return -1;
+	}
+	cpus = malloc(sizeof(*cpus) * CPU_COUNT(&allowed));
+	if (!cpus)
+		return -1;
+	for (i = 0; i < CPU_SETSIZE && nr_cpus < CPU_COUNT(&allowed); i++) {
+		if (CPU_ISSET(i, &allowed))
+			cpus[nr_cpus++] = i;
+	}
+	if (max_threads <= 0 || max_threads > nr_cpus)
+		max_threads = nr_cpus;
+
+	if (issue_request(0, 1, 0) < 0)
+		fprintf(stderr, "warning: issue_request failed, is elevator.ko loaded?\n");
+	if (valid)
+		fprintf(stderr, "note: --valid recreates elevator system%s 1%s each step, up to %lld requests queued\n",
+			systems ? "s" : "", systems ? ".." : "", backlog);
+
+	if (csv) {
+		printf("threads,ops,ops_per_sec,min_thread_ops,max_thread_ops,fairness,p50_ns,p90_ns,p99_ns,p999_ns");
+		if (lock_stat)
+			printf(",contentions,acquisitions,wait_avg_us,wait_max_us");
+		printf("\n");
+	} else {
+		printf("issue_request (%s), %d s per step\n",
+		       systems ? "one system per thread" : valid ? "valid" : "rejected", seconds);
+		printf("%3s %12s %12s %11s %11s %6s %8s %8s %8s %8s", "thr", "ops", "ops/s", "min/thread",
+		       "max/thread", "fair", "p50", "p90", "p99", "p99.9");
+		if (lock_stat)
+			printf(" %12s %12s %10s %10s", "contentions", "acquired", "wait avg", "wait max");
+		printf("\n");
+	}
+
+	// 1, 2, 4... and the full count when that isn't a power of two
+	for (t = 1; t <= max_threads; t = t * 2 > max_threads && t != max_threads ? max_threads : t * 2) {
+		if (run(t, cpus, seconds, backlog, lock_stat, csv))
+			return -1;
+	}
+
+	free(cpus);
+	return 0;
+}
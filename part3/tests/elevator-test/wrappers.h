@@ -4,10 +4,32 @@
 #define _GNU_SOURCE
 #include <unistd.h>
 #include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <stdio.h>
 
 #define __NR_START_ELEVATOR 548
 #define __NR_ISSUE_REQUEST 549
 #define __NR_STOP_ELEVATOR 550
+#define __NR_ISSUE_REQUEST_EXT 551
+#define __NR_QUERY_REQUEST 552
+#define __NR_START_ELEVATOR_SYSTEM 553
+#define __NR_STOP_ELEVATOR_SYSTEM 554
+
+// layout must match elevator_ops.h
+#define ELEVATOR_ETA_UNKNOWN 0xffffffffU
+
+struct elevator_request {
+	int start_floor;
+	int dest_floor;
+	int type;
+	unsigned int count;
+	unsigned int id;		// set by issue_request_ext
+	unsigned int pickup_ms;		// estimates, ELEVATOR_ETA_UNKNOWN while
+	unsigned int delivery_ms;	// the elevator isn't running
+	unsigned int system;		// elevator system, 0 is the default one
+};
 
 int start_elevator() {
 	return syscall(__NR_START_ELEVATOR);
@@ -21,4 +43,155 @@ int stop_elevator() {
 	return syscall(__NR_STOP_ELEVATOR);
 }
 
+// count identical pets in one call, they wait as a single queue entry
+int issue_group_request(int start, int dest, int type, int count) {
+	struct elevator_request req = {
+		.start_floor = start,
+		.dest_floor = dest,
+		.type = type,
+		.count = count,
+	};
+
+	return syscall(__NR_ISSUE_REQUEST_EXT, &req, sizeof(req));
+}
+
+// fills in req->id and the estimated pickup/delivery times (ms from now)
+int issue_request_eta(struct elevator_request *req) {
+	return syscall(__NR_ISSUE_REQUEST_EXT, req, sizeof(*req));
+}
+
+// current estimates for req->id, -1 with errno ENOENT once it was delivered
+int query_request(struct elevator_request *req) {
+	return syscall(__NR_QUERY_REQUEST, req, sizeof(*req));
+}
+
+// other elevator systems, made by writing "create" to /proc/elevators/control.
+// the three calls above always drive system 0
+int start_elevator_system(unsigned int system) {
+	return syscall(__NR_START_ELEVATOR_SYSTEM, system);
+}
+
+int stop_elevator_system(unsigned int system) {
+	return syscall(__NR_STOP_ELEVATOR_SYSTEM, system);
+}
+
+int issue_system_request(unsigned int system, int start, int dest, int type, int count) {
+	struct elevator_request req = {
+		.start_floor = start,
+		.dest_floor = dest,
+		.type = type,
+		.count = count,
+		.system = system,
+	};
+
+	return syscall(__NR_ISSUE_REQUEST_EXT, &req, sizeof(req));
+}
+
+// Shared-memory rings (layout must match elevator.c).
+// Producers fill sqes and bump sq_tail, the kernel posts a completion when a
+// request is accepted and again when the pet is delivered.
+#define RING_DEV "/dev/elevator_ring"
+#define RING_SQ_ENTRIES 256
+#define RING_CQ_ENTRIES 1024
+#define RING_NEED_WAKEUP 1
+#define RING_EVENT_ACCEPTED 1
+#define RING_EVENT_DELIVERED 2
+#define ELEVATOR_RING_ENTER _IO('e', 1)
+
+struct elevator_sqe {
+	int start_floor;
+	int dest_floor;
+	int type;
+	int count;
+	unsigned long long tag;
+};
+
+struct elevator_cqe {
+	unsigned long long tag;
+	int event;
+	int result;
+};
+
+struct elevator_ring {
+	unsigned int sq_head;
+	unsigned int sq_tail;
+	unsigned int flags;
+	unsigned int sq_entries;
+	unsigned int cq_head __attribute__((aligned(64)));
+	unsigned int cq_tail;
+	unsigned int cq_overflow;
+	unsigned int cq_entries;
+	struct elevator_sqe sqes[RING_SQ_ENTRIES] __attribute__((aligned(64)));
+	struct elevator_cqe cqes[RING_CQ_ENTRIES];
+};
+
+// maps the rings of a system, returns NULL on failure. *fd is needed for
+// ring_enter and poll. system 0 is RING_DEV, the others RING_DEV<id>
+struct elevator_ring *ring_open_system(unsigned int system, int *fd) {
+	char path[64];
+	void *p;
+
+	if (system == 0)
+		snprintf(path, sizeof(path), "%s", RING_DEV);
+	else
+		snprintf(path, sizeof(path), "%s%u", RING_DEV, system);
+	*fd = open(path, O_RDWR);
+	if (*fd < 0)
+		return NULL;
+	p = mmap(NULL, sizeof(struct elevator_ring), PROT_READ | PROT_WRITE, MAP_SHARED, *fd, 0);
+	if (p == MAP_FAILED) {
+		close(*fd);
+		return NULL;
+	}
+	return p;
+}
+
+struct elevator_ring *ring_open(int *fd) {
+	return ring_open_system(0, fd);
+}
+
+// returns 0, or -1 if the submission ring is full. the delivered completion
+// comes once the whole group has arrived. nothing reaches the kernel until
+// ring_enter, so queue a batch first
+int ring_submit_group(struct elevator_ring *ring, int start, int dest, int type, int count,
+		      unsigned long long tag) {
+	unsigned int tail = ring->sq_tail;
+	struct elevator_sqe *sqe;
+
+	if (tail - __atomic_load_n(&ring->sq_head, __ATOMIC_ACQUIRE) >= RING_SQ_ENTRIES)
+		return -1;
+
+	sqe = &ring->sqes[tail & (RING_SQ_ENTRIES - 1)];
+	sqe->start_floor = start;
+	sqe->dest_floor = dest;
+	sqe->type = type;
+	sqe->count = count;
+	sqe->tag = tag;
+	__atomic_store_n(&ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+// after a batch of ring_submit: only enter the kernel when it has drained
+// the ring and gone to sleep on it
+void ring_enter(struct elevator_ring *ring, int fd) {
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&ring->flags, __ATOMIC_RELAXED) & RING_NEED_WAKEUP)
+		ioctl(fd, ELEVATOR_RING_ENTER);
+}
+
+int ring_submit(struct elevator_ring *ring, int start, int dest, int type, unsigned long long tag) {
+	return ring_submit_group(ring, start, dest, type, 1, tag);
+}
+
+// copies the next completion into *cqe, returns 0 if there was none
+int ring_reap(struct elevator_ring *ring, struct elevator_cqe *cqe) {
+	unsigned int head = ring->cq_head;
+
+	if (head == __atomic_load_n(&ring->cq_tail, __ATOMIC_ACQUIRE))
+		return 0;
+	*cqe = ring->cqes[head & (RING_CQ_ENTRIES - 1)];
+	__atomic_store_n(&ring->cq_head, head + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
 #endif
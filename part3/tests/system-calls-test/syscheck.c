@@ -1,6 +1,7 @@
 #include <linux/init.h>
 #include <linux/module.h>
 #include <linux/kernel.h>
+#include "../../elevator_ops.h"
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("cop4610t");
@@ -11,9 +12,6 @@ int start_elevator(void);
 int issue_request(int start_floor, int destination_floor, int type);                // add passengers requests to specific floors
 int stop_elevator(void);                                                            // stops the elevator
 
-extern int (*STUB_start_elevator)(void);
-extern int (*STUB_issue_request)(int,int,int);
-extern int (*STUB_stop_elevator)(void);
 
 int start_elevator(void) {
     return 0;
@@ -27,17 +25,18 @@ int stop_elevator(void) {
     return 0;
 }
 
+static const struct elevator_ops syscheck_ops = {
+	.start_elevator = start_elevator,
+	.issue_request = issue_request,
+	.stop_elevator = stop_elevator,
+};
+
 static int __init syscheck_init(void) {
-    STUB_start_elevator = start_elevator;
-	STUB_issue_request = issue_request;
-	STUB_stop_elevator = stop_elevator;
-    return 0;  // Return 0 to indicate successful loading
+    return elevator_register_ops(&syscheck_ops);  // Return 0 to indicate successful loading
 }
 
 static void __exit syscheck_exit(void) {
-    STUB_start_elevator = NULL;
-	STUB_issue_request = NULL;
-	STUB_stop_elevator = NULL;
+    elevator_unregister_ops(&syscheck_ops);
 }
 
 module_init(syscheck_init);  // Specify the initialization function